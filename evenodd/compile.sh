@@ -1,5 +1,7 @@
 #!/bin/bash
 
-gcc -o evenodd evenodd.c -O3
-
-
+gcc -c libevenodd.c -O3 -o libevenodd.o
+ar rcs libevenodd.a libevenodd.o
+rm libevenodd.o
+gcc -o evenodd evenodd.c libevenodd.a -O3 -pthread
+gcc -o evenodd_bench evenodd_bench.c libevenodd.a -O3 -lm
@@ -1,22 +1,39 @@
+#define _GNU_SOURCE // O_DIRECT
+
 #include <assert.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evenodd_uring.h"
+#include "libevenodd.h"
 
 typedef __uint128_t uint128;
-typedef unsigned long long uint64;
 
 long long min64(long long x, long long y) { return x < y ? x : y; }
-
-#define mod_p(x) (((x) < 0) ? ((x) + p) : (x))
+long long max64(long long x, long long y) { return x > y ? x : y; }
 
 struct stat get_file_stat(const char *file_name) {
   struct stat file_stat;
-  stat(file_name, &file_stat);
+  if (stat(file_name, &file_stat) != 0) // 文件不存在时各项均为 0
+    memset(&file_stat, 0, sizeof(file_stat));
   return file_stat;
 }
 
@@ -50,7 +67,289 @@ const int MAX_IO_BUFFER_SIZE_SUM =
 const int MAX_PER_IO_BUFFER_SIZE =
     1 << 16; // 单个 IO 缓存区大小最大字节数，防止缓存过大影响速度
 const int MAX_FILE_NAME_LENGTH = 260; // 文件名的最大长度
-const int MAX_P = 100;                // p 的最大值
+enum { MAX_P = 100 };                 // p 的最大值，也用作数组长度
+const int MIN_ELEMENT_SIZE = 8;       // 元素字节数的最小值
+const int MAX_ELEMENT_SIZE = 1 << 16; // 元素字节数的最大值
+const int DIRECT_ALIGN = 4096; // O_DIRECT 读写的对齐字节数（逻辑块大小的倍数）
+const int MAX_POOL_FREE_NUM = 64; // 对齐缓存池中最多保留的空闲缓存区数
+const int MAX_IOV_NUM = 1024; // 单次 preadv / pwritev 的最大段数（IOV_MAX）
+
+enum { STATS_OFF, STATS_TEXT, STATS_JSON };
+
+/**
+ * @brief 命令行选项。
+ * 每个线程一份：serve 模式下各工作线程分别解析自己收到的请求，
+ * 用 create_thread 创建的线程继承创建者的选项。
+ */
+struct Options {
+  int element_size;      // write 时每个元素的字节数
+  int threads;           // 线程数，为 1 时不使用多线程；serve 时为工作线程数
+  bool io_uring;         // Input / Output 是否使用 io_uring 后端
+  bool direct;           // 是否用 O_DIRECT 读写列文件，绕过页缓存
+  long long offset;      // read 的起始字节
+  long long length;      // read 的字节数，为负数时读到文件末尾
+  bool write_back;       // read 之后是否把损坏的列修复到磁盘上
+  bool crc;              // write 时是否在每列末尾写入各数据块的 CRC32C
+  long long rate;        // scrub 每秒最多读取的字节数，为 0 时不限速
+  bool repair;           // scrub 时是否改正不一致的条带
+  bool pack;             // write 时是否把小文件追加到共享的容器中
+  const char *socket;    // serve 监听的 UNIX 套接字路径
+  const char *from_list; // 批量 write / read 的列表文件
+  int code;              // write 时的编码方式（CODE_EVENODD / CODE_RDP）
+  int stats;             // 命令结束时输出的统计（STATS_OFF / TEXT / JSON）
+};
+#define DEFAULT_OPTIONS                                                        \
+  {MIN_ELEMENT_SIZE, 1, false, false, 0, -1, false, false, 0, false, false,    \
+   NULL, NULL, CODE_EVENODD, STATS_OFF}
+__thread struct Options options = DEFAULT_OPTIONS;
+
+/*
+ * 命令的输出。report_file 为 NULL 时写到 stdout；serve 模式下指向每个请求
+ * 各自的内存流，输出随回复一起发给客户端。
+ */
+__thread FILE *report_file = NULL;
+
+void report(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(report_file != NULL ? report_file : stdout, format, args);
+  va_end(args);
+}
+
+/*
+ * --stats：命令结束时输出各阶段的耗时和读写统计。每条命令（serve 模式下
+ * 每个请求）各有一份计数，由 run_command 分配，执行命令的线程和它创建的
+ * 线程经线程局部的 stats 指针共用。
+ * 每个线程任一时刻处于读、计算、写三个阶段之一，或不计时（PHASE_IDLE：
+ * 等待其他线程、限速等）。enter_phase 切换阶段时，把上一段的墙钟时间和
+ * 本线程的 CPU 时间计入原来的阶段：读写函数在系统调用前后切换到读 / 写
+ * 阶段，命令的其余部分处于计算阶段。多线程时各阶段的时间是所有线程之和。
+ * 各列读写的字节数按描述符区分，列文件在打开时用 track_fd 登记。
+ */
+enum { PHASE_IDLE = -1, PHASE_READ, PHASE_COMPUTE, PHASE_WRITE, PHASE_NUM };
+
+struct Stats {
+  atomic_llong wall_ns[PHASE_NUM], cpu_ns[PHASE_NUM]; // 各阶段的耗时
+  atomic_llong read_calls, write_calls;       // 读 / 写的系统调用次数
+  atomic_llong input_flushes, output_flushes; // flush_input / flush_output 次数
+  atomic_llong stripes;                       // 处理的条带数
+  atomic_llong repair_files;                  // repair 遍历修复的文件数
+  // 第 0 项为列文件以外的文件，第 i + 1 项为第 i 列（共 MAX_P + 2 列）
+  atomic_llong read_bytes[MAX_P + 3], write_bytes[MAX_P + 3];
+};
+__thread struct Stats *stats = NULL; // 当前命令的计数
+// 描述符对应的列号 + 1，0 表示不是列文件；由 track_fd 在打开时登记。
+// 各线程同时打开、读写文件，用 relaxed 原子操作读写
+atomic_short fd_column[1 << 16];
+__thread int phase = PHASE_IDLE;                // 当前线程所处的阶段
+__thread struct timespec phase_wall, phase_cpu; // 进入该阶段的时刻
+
+long long elapsed_ns(const struct timespec *st, const struct timespec *ed) {
+  return (ed->tv_sec - st->tv_sec) * 1000000000LL + (ed->tv_nsec - st->tv_nsec);
+}
+
+/**
+ * @brief 当前线程切换到阶段 next，把上一段时间计入原来的阶段。
+ * 未使用 --stats 时不做任何事。
+ * @return 原来的阶段，用于之后切换回去
+ * @example const int last = enter_phase(PHASE_READ); ... enter_phase(last);
+ */
+int enter_phase(int next) {
+  struct timespec wall, cpu;
+  const int last = phase;
+
+  if (options.stats == STATS_OFF || next == last)
+    return last;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  if (last != PHASE_IDLE) {
+    atomic_fetch_add(&stats->wall_ns[last], elapsed_ns(&phase_wall, &wall));
+    atomic_fetch_add(&stats->cpu_ns[last], elapsed_ns(&phase_cpu, &cpu));
+  }
+  phase = next;
+  phase_wall = wall;
+  phase_cpu = cpu;
+  return last;
+}
+
+/**
+ * @brief 登记刚打开的描述符 fd 属于哪一列（path 形如 "disk_<i>/..."）。
+ * 描述符会被复用，所以列文件以外经过计数的描述符也要登记。
+ * @return NULL
+ */
+void track_fd(int fd, const char *path) {
+  int column;
+
+  if (options.stats == STATS_OFF || fd < 0 || fd >= (1 << 16))
+    return;
+  if (sscanf(path, "disk_%d/", &column) != 1 || column < 0 ||
+      column >= MAX_P + 2)
+    column = -1;
+  atomic_store_explicit(&fd_column[fd], column + 1, memory_order_relaxed);
+}
+
+/**
+ * @brief 记录一次读（PHASE_READ）或写（PHASE_WRITE）系统调用及其字节数。
+ * @return NULL
+ */
+void count_io(int kind, int fd, long long bytes) {
+  if (options.stats == STATS_OFF)
+    return;
+  const int c =
+      fd >= 0 && fd < (1 << 16)
+          ? atomic_load_explicit(&fd_column[fd], memory_order_relaxed)
+          : 0;
+  bytes = max64(bytes, 0);
+  if (kind == PHASE_READ) {
+    atomic_fetch_add(&stats->read_calls, 1);
+    atomic_fetch_add(&stats->read_bytes[c], bytes);
+  } else {
+    atomic_fetch_add(&stats->write_calls, 1);
+    atomic_fetch_add(&stats->write_bytes[c], bytes);
+  }
+}
+
+void add_stat(atomic_llong *counter, long long x) {
+  if (options.stats != STATS_OFF)
+    atomic_fetch_add(counter, x);
+}
+
+/**
+ * @brief 让出 CPU，等待其他线程；期间不计入任何阶段。
+ */
+void yield_idle() {
+  const int last = enter_phase(PHASE_IDLE);
+  sched_yield();
+  enter_phase(last);
+}
+
+/**
+ * @brief 等待线程 thread 结束；期间不计入任何阶段。
+ */
+void join_thread(pthread_t thread) {
+  const int last = enter_phase(PHASE_IDLE);
+  pthread_join(thread, NULL);
+  enter_phase(last);
+}
+
+/**
+ * @brief create_thread 传给新线程的参数。
+ */
+struct Thread_start {
+  void *(*routine)(void *);
+  void *arg;
+  struct Options options;
+  FILE *report_file;
+  struct Stats *stats;
+  int phase;
+};
+
+void *thread_start(void *arg) {
+  struct Thread_start start = *(struct Thread_start *)arg;
+
+  free(arg);
+  options = start.options;
+  report_file = start.report_file;
+  stats = start.stats;
+  enter_phase(start.phase);
+  void *ret = start.routine(start.arg);
+  enter_phase(PHASE_IDLE);
+  return ret;
+}
+
+/**
+ * @brief 创建线程，新线程继承当前线程的选项、输出、--stats 的计数和阶段。
+ * @return pthread_create 的返回值
+ */
+int create_thread(pthread_t *thread, void *(*routine)(void *), void *arg) {
+  struct Thread_start *start =
+      (struct Thread_start *)malloc(sizeof(struct Thread_start));
+
+  *start = (struct Thread_start){routine, arg, options, report_file, stats,
+                                 phase};
+  return pthread_create(thread, NULL, thread_start, start);
+}
+
+/**
+ * @brief O_DIRECT 读写用的对齐缓存池。
+ * 释放的缓存区按大小挂在空闲链表上，再次申请同样大小时直接复用，
+ * 修复整个目录时不必为每个文件重新申请对齐内存。
+ */
+struct Pool_buffer {
+  void *ptr;
+  long long bytes;
+  struct Pool_buffer *next;
+};
+struct Buffer_pool {
+  pthread_mutex_t lock;
+  struct Pool_buffer *free_list;
+  int free_num;
+};
+struct Buffer_pool buffer_pool = {PTHREAD_MUTEX_INITIALIZER, NULL, 0};
+
+/**
+ * @brief 从缓存池申请 bytes 字节，首地址按 DIRECT_ALIGN 对齐。
+ * @return 缓存区首地址
+ */
+void *pool_alloc(long long bytes) {
+  struct Pool_buffer **it, *node = NULL;
+  void *ptr;
+
+  bytes = (bytes + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+  pthread_mutex_lock(&buffer_pool.lock);
+  for (it = &buffer_pool.free_list; *it != NULL; it = &(*it)->next)
+    if ((*it)->bytes == bytes) {
+      node = *it;
+      *it = node->next;
+      buffer_pool.free_num--;
+      break;
+    }
+  pthread_mutex_unlock(&buffer_pool.lock);
+  if (node != NULL) {
+    ptr = node->ptr;
+    free(node);
+    return ptr;
+  }
+  if (posix_memalign(&ptr, DIRECT_ALIGN, bytes) != 0)
+    return NULL;
+  return ptr;
+}
+
+/**
+ * @brief 把 pool_alloc 申请的缓存区还给缓存池。
+ * @param bytes 申请时的字节数
+ * @return NULL
+ */
+void pool_free(void *ptr, long long bytes) {
+  struct Pool_buffer *node;
+
+  if (ptr == NULL)
+    return;
+  pthread_mutex_lock(&buffer_pool.lock);
+  if (buffer_pool.free_num == MAX_POOL_FREE_NUM) {
+    pthread_mutex_unlock(&buffer_pool.lock);
+    free(ptr);
+    return;
+  }
+  node = (struct Pool_buffer *)malloc(sizeof(struct Pool_buffer));
+  node->ptr = ptr;
+  node->bytes = (bytes + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+  node->next = buffer_pool.free_list;
+  buffer_pool.free_list = node;
+  buffer_pool.free_num++;
+  pthread_mutex_unlock(&buffer_pool.lock);
+}
+
+/**
+ * @brief 以 O_DIRECT 方式打开文件，文件系统不支持时退回普通方式。
+ * @return 文件描述符
+ */
+int open_direct(const char *file_name, int flags) {
+  int fd = open(file_name, flags | O_DIRECT);
+  return fd >= 0 ? fd : open(file_name, flags);
+}
+
 /**
  * @brief 用于进行二进制文件输入的结构体（带缓存区）。
  *
@@ -73,25 +372,276 @@ struct Input {
   uint64 *st, *ed, *p;
   FILE *file;
   int remain;
+
+  // 以下仅用于 io_uring 后端（ring 为 NULL 时使用 stdio）
+  struct Ring *ring;       // 初始化时所在线程的 Ring
+  uint64 *spare;           // 预读缓存区，与 st 轮换使用
+  struct Ring_request req; // spare 上的读请求
+  long long offset;        // 下一次读的文件偏移
+  int file_index;          // 在 ring 注册文件表中的下标
+  bool fixed;              // st 和 spare 是否位于 ring 的注册缓存区内
+
+  // 以下仅用于 O_DIRECT 后端（direct_fd 为 -1 时不使用）
+  int direct_fd;       // 以 O_DIRECT 打开的描述符，与 file 指向同一文件
+  uint64 *raw;         // 对齐缓存区，st 指向其中
+  long long raw_bytes; // raw 的字节数
 };
 
+/**
+ * @brief 为异步 Input / Output 申请两个 words 个 uint64 的缓存区。
+ * 优先从当前线程 Ring 的注册缓存区中申请。
+ * @return 是否位于注册缓存区内
+ */
+bool alloc_ring_buffers(struct Ring *ring, long long words, uint64 **st,
+                        uint64 **spare) {
+  *st = (uint64 *)ring_alloc(ring, words << 3);
+  if (*st != NULL) {
+    *spare = (uint64 *)ring_alloc(ring, words << 3);
+    if (*spare != NULL)
+      return true;
+    ring_free(ring);
+  }
+  *st = (uint64 *)malloc(words << 3);
+  *spare = (uint64 *)malloc(words << 3);
+  return false;
+}
+
+void free_ring_buffers(struct Ring *ring, bool fixed, uint64 *st,
+                       uint64 *spare) {
+  if (fixed) {
+    ring_free(ring);
+    ring_free(ring);
+  } else {
+    free(st);
+    free(spare);
+  }
+}
+
+/**
+ * @brief 把 ring 上的请求提交到当前线程的 Ring。
+ * 在初始化时的线程中提交时使用注册缓存区和注册文件，否则使用普通读写。
+ */
+void submit_ring_request(struct Ring *owner, struct Ring_request *req,
+                         bool write, FILE *file, int file_index, void *buf,
+                         bool fixed, long long len, long long offset) {
+  struct Ring *ring = get_ring();
+  const bool own = ring == owner;
+
+  ring_submit(ring, req, write, fileno(file), own ? file_index : -1, buf,
+              own && fixed, len, offset);
+}
+
+/**
+ * @brief 完整地按偏移读入 len 字节，不足部分补零。
+ * @return 实际读到的字节数
+ */
+long long pread_full(int fd, void *buf, long long len, long long offset) {
+  const int last = enter_phase(PHASE_READ);
+  long long got = 0, ret;
+
+  while (got < len && (ret = pread(fd, (char *)buf + got, len - got,
+                                   offset + got)) > 0) {
+    count_io(PHASE_READ, fd, ret);
+    got += ret;
+  }
+  enter_phase(last);
+  if (got < len)
+    memset((char *)buf + got, 0, len - got);
+  return got;
+}
+
+/**
+ * @brief 完整地按偏移写出 len 字节。
+ * @return 是否全部写出（pwrite 出错时失败，如 ENOSPC、EIO）
+ */
+bool pwrite_full(int fd, const void *buf, long long len, long long offset) {
+  const int last = enter_phase(PHASE_WRITE);
+  long long done = 0, ret;
+
+  while (done < len && (ret = pwrite(fd, (const char *)buf + done,
+                                     len - done, offset + done)) > 0) {
+    count_io(PHASE_WRITE, fd, ret);
+    done += ret;
+  }
+  enter_phase(last);
+  return done == len;
+}
+
+/**
+ * @brief 用 writev 完整地写出 iov 中的 cnt 段数据，写到 fd 的当前位置。
+ * 写得不完整时会修改 iov，从未写完的位置继续写。
+ * @return 是否全部写出（writev 出错时失败）
+ */
+bool writev_full(int fd, struct iovec *iov, int cnt) {
+  const int last = enter_phase(PHASE_WRITE);
+  long long ret;
+
+  while (cnt > 0 && (ret = writev(fd, iov, min64(cnt, MAX_IOV_NUM))) > 0) {
+    count_io(PHASE_WRITE, fd, ret);
+    for (; cnt > 0 && ret > 0; iov++, cnt--) { // 跳过已写完的段
+      if (ret < (long long)iov->iov_len) {
+        iov->iov_base = (char *)iov->iov_base + ret;
+        iov->iov_len -= ret;
+        break;
+      }
+      ret -= iov->iov_len;
+    }
+  }
+  enter_phase(last);
+  return cnt == 0;
+}
+
+/**
+ * @brief preadv，计入 --stats 的读统计。
+ * @return preadv 的返回值
+ */
+long long pread_iov(int fd, const struct iovec *iov, int cnt,
+                    long long offset) {
+  const int last = enter_phase(PHASE_READ);
+  const long long ret = preadv(fd, iov, cnt, offset);
+
+  count_io(PHASE_READ, fd, ret);
+  enter_phase(last);
+  return ret;
+}
+
+/**
+ * @brief pwritev，计入 --stats 的写统计。
+ * @return pwritev 的返回值
+ */
+long long pwrite_iov(int fd, const struct iovec *iov, int cnt,
+                     long long offset) {
+  const int last = enter_phase(PHASE_WRITE);
+  const long long ret = pwritev(fd, iov, cnt, offset);
+
+  count_io(PHASE_WRITE, fd, ret);
+  enter_phase(last);
+  return ret;
+}
+
+/**
+ * @brief fread，计入 --stats 的读统计（按一次系统调用计）。
+ * @return 读到的字节数
+ */
+long long fread_counted(void *buf, long long len, FILE *file) {
+  const int last = enter_phase(PHASE_READ);
+  const long long got = fread(buf, 1, len, file);
+
+  count_io(PHASE_READ, fileno(file), got);
+  enter_phase(last);
+  return got;
+}
+
+/**
+ * @brief fwrite，计入 --stats 的写统计（按一次系统调用计）。
+ * @return 是否全部写出
+ */
+bool fwrite_counted(const void *buf, long long len, FILE *file) {
+  const int last = enter_phase(PHASE_WRITE);
+  const long long done = fwrite(buf, 1, len, file);
+
+  count_io(PHASE_WRITE, fileno(file), done);
+  enter_phase(last);
+  return done == len;
+}
+
+/**
+ * @brief 把覆盖 [offset, offset + len) 的对齐区间读入对齐缓存区 raw，
+ * 文件不足的部分补零。raw 至少需要 len + 2 * DIRECT_ALIGN 字节。
+ * @return 偏移 offset 处的数据在 raw 中的地址
+ */
+char *pread_aligned(int fd, char *raw, long long len, long long offset) {
+  const long long start = offset / DIRECT_ALIGN * DIRECT_ALIGN;
+  const long long end =
+      (offset + len + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+  pread_full(fd, raw, end - start, start);
+  return raw + (offset - start);
+}
+
+/**
+ * @brief 按偏移读入任意区间的 len 字节，文件不足的部分补零。
+ * fd 可以以 O_DIRECT 方式打开：先读入池中的对齐缓存区，再复制到 buf。
+ * @return NULL
+ */
+void pread_unaligned(int fd, void *buf, long long len, long long offset) {
+  const long long bytes = len + 2 * DIRECT_ALIGN;
+  char *raw = (char *)pool_alloc(bytes);
+
+  memcpy(buf, pread_aligned(fd, raw, len, offset), len);
+  pool_free(raw, bytes);
+}
+
+/**
+ * @brief 按偏移写出任意区间的 len 字节。
+ * 数据位于对齐缓存区 raw 中，raw 的开头对应 offset 向下对齐的文件偏移。
+ * 完整的块用 direct_fd（O_DIRECT）写出，首尾不完整的块用 buffered_fd 写出。
+ * @return 是否全部写出
+ */
+bool pwrite_unaligned(int direct_fd, int buffered_fd, const char *raw,
+                      long long len, long long offset) {
+  const char *data = raw + offset % DIRECT_ALIGN;
+  const long long head =
+      min64(len, (DIRECT_ALIGN - offset % DIRECT_ALIGN) % DIRECT_ALIGN);
+  const long long body = (len - head) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+  return pwrite_full(buffered_fd, data, head, offset) &&
+         pwrite_full(direct_fd, data + head, body, offset + head) &&
+         pwrite_full(buffered_fd, data + head + body, len - head - body,
+                     offset + head + body);
+}
+
 /**
  * @brief 初始化 Input。
  * 为 (*buffer) 申请 size 字节的空间，设置其输入文件名为 file_name。
  * @param buffer 指向 Input 的指针
  * @param size 申请字节大小（会自动变为 ceil(size / 8) * 8）
  * @param file_name 文件名
- * @return NULL
+ * @return 文件能否打开，不能打开时不申请任何资源
  */
-void init_input(struct Input *buffer, long long size, int n,
+bool init_input(struct Input *buffer, long long size, int n,
                 const char *file_name) {
   size = min64(size, get_file_stat(file_name).st_size);
   size = min64(size, MAX_PER_IO_BUFFER_SIZE);
   size = ((size >> 3) / n + 1) * n;
-  buffer->st = (uint64 *)malloc(size << 3);
+  buffer->file = fopen(file_name, "rb");
+  if (buffer->file == NULL)
+    return false;
+  buffer->direct_fd = options.direct ? open_direct(file_name, O_RDONLY) : -1;
+  track_fd(fileno(buffer->file), file_name);
+  track_fd(buffer->direct_fd, file_name);
+  buffer->ring =
+      options.io_uring && buffer->direct_fd < 0 ? get_ring() : NULL;
+  if (buffer->direct_fd >= 0) {
+    buffer->raw_bytes = (size << 3) + 2 * DIRECT_ALIGN;
+    buffer->raw = (uint64 *)pool_alloc(buffer->raw_bytes);
+    buffer->st = buffer->raw;
+    buffer->offset = 0;
+  } else if (buffer->ring != NULL) {
+    buffer->fixed =
+        alloc_ring_buffers(buffer->ring, size, &buffer->st, &buffer->spare);
+    buffer->file_index = ring_register_file(buffer->ring, fileno(buffer->file));
+    buffer->req.state = 0;
+    buffer->offset = 0;
+  } else
+    buffer->st = (uint64 *)pool_alloc(size << 3);
   buffer->ed = buffer->st + size;
   buffer->p = buffer->ed;
-  buffer->file = fopen(file_name, "rb");
+  return true;
+}
+
+/**
+ * @brief 在 spare 上提交下一段预读。
+ * @param buffer 指向 Input 的指针
+ * @return NULL
+ */
+void prefetch_input(struct Input *buffer) {
+  const long long bytes = (buffer->ed - buffer->st) << 3;
+
+  submit_ring_request(buffer->ring, &buffer->req, false, buffer->file,
+                      buffer->file_index, buffer->spare, buffer->fixed, bytes,
+                      buffer->offset);
+  buffer->offset += bytes;
 }
 
 /**
@@ -102,8 +652,41 @@ void init_input(struct Input *buffer, long long size, int n,
  */
 void flush_input(struct Input *buffer) {
   assert(buffer->p == buffer->ed);
+  add_stat(&stats->input_flushes, 1);
+  if (buffer->direct_fd >= 0) { // 读入覆盖下一段的对齐区间，st 指向其中
+    const long long size = buffer->ed - buffer->st;
+
+    buffer->st = (uint64 *)pread_aligned(buffer->direct_fd,
+                                         (char *)buffer->raw, size << 3,
+                                         buffer->offset);
+    buffer->ed = buffer->st + size;
+    buffer->p = buffer->st;
+    buffer->offset += size << 3;
+    return;
+  }
+  if (buffer->ring != NULL) { // 等待预读完成，换到预读好的缓存区后再预读下一段
+    const long long size = buffer->ed - buffer->st;
+    uint64 *tmp = buffer->st;
+
+    if (buffer->req.state == 0)
+      prefetch_input(buffer);
+    const int last = enter_phase(PHASE_READ);
+    long long got = ring_wait(&buffer->req);
+    got = got < 0 ? 0 : got;
+    count_io(PHASE_READ, fileno(buffer->file), got);
+    enter_phase(last);
+    if (got < (size << 3)) // 读得不完整时同步读完，文件末尾之后补零
+      pread_full(fileno(buffer->file), (char *)buffer->spare + got,
+                 (size << 3) - got, buffer->offset - (size << 3) + got);
+    buffer->st = buffer->spare;
+    buffer->spare = tmp;
+    buffer->ed = buffer->st + size;
+    buffer->p = buffer->st;
+    prefetch_input(buffer);
+    return;
+  }
   memset(buffer->st, 0, (buffer->ed - buffer->st) << 3);
-  fread(buffer->st, 1, (buffer->ed - buffer->st) << 3, buffer->file);
+  fread_counted(buffer->st, (buffer->ed - buffer->st) << 3, buffer->file);
   buffer->p = buffer->st;
 }
 
@@ -113,15 +696,43 @@ void flush_input(struct Input *buffer) {
  * @return NULL
  */
 void del_input(struct Input *buffer) {
+  if (buffer->direct_fd >= 0) {
+    close(buffer->direct_fd);
+    pool_free(buffer->raw, buffer->raw_bytes);
+    fclose(buffer->file);
+    buffer->st = buffer->ed = buffer->p = buffer->raw = NULL;
+    buffer->file = NULL;
+    return;
+  }
+  if (buffer->ring != NULL) {
+    if (buffer->req.state != 0)
+      ring_wait(&buffer->req);
+    ring_unregister_file(buffer->ring, buffer->file_index);
+    free_ring_buffers(buffer->ring, buffer->fixed, buffer->st, buffer->spare);
+    fclose(buffer->file);
+    buffer->st = buffer->ed = buffer->p = buffer->spare = NULL;
+    buffer->file = NULL;
+    return;
+  }
   fclose(buffer->file);
-  free(buffer->st);
+  pool_free(buffer->st, (buffer->ed - buffer->st) << 3);
   buffer->st = buffer->ed = buffer->p = NULL;
   buffer->file = NULL;
 }
 
 uint64 read_uint64_direct(struct Input *buffer) {
   uint64 x;
-  fread(&x, 1, 8, buffer->file);
+  if (buffer->direct_fd >= 0) {
+    pread_unaligned(buffer->direct_fd, &x, 8, buffer->offset);
+    buffer->offset += 8;
+    return x;
+  }
+  if (buffer->ring != NULL) {
+    pread_full(fileno(buffer->file), &x, 8, buffer->offset);
+    buffer->offset += 8;
+    return x;
+  }
+  fread_counted(&x, 8, buffer->file);
   return x;
 }
 uint64 read_uint64_unsafe(struct Input *buffer) { return *(buffer->p++); }
@@ -129,6 +740,25 @@ void read_array_unsafe(uint64 *a, struct Input *buffer, int n) {
   memcpy(a, buffer->p, n << 3);
   buffer->p += n;
 }
+/**
+ * @brief 绕过缓存区直接读入 n 个 uint64 到 a，文件不足的部分补零。
+ * 不能与 flush_input 混用。
+ * @return NULL
+ */
+void read_array_direct(uint64 *a, struct Input *buffer, long long n) {
+  if (buffer->direct_fd >= 0) {
+    pread_unaligned(buffer->direct_fd, a, n << 3, buffer->offset);
+    buffer->offset += n << 3;
+    return;
+  }
+  if (buffer->ring != NULL) {
+    pread_full(fileno(buffer->file), a, n << 3, buffer->offset);
+    buffer->offset += n << 3;
+    return;
+  }
+  long long got = fread_counted(a, n << 3, buffer->file);
+  memset((char *)a + got, 0, (n << 3) - got);
+}
 
 /**
  * @brief 用于进行二进制文件输出的结构体（带缓存区）。
@@ -150,6 +780,36 @@ void read_array_unsafe(uint64 *a, struct Input *buffer, int n) {
 struct Output {
   uint64 *st, *ed, *p;
   FILE *file;
+
+  // 以下仅用于 io_uring 后端（ring 为 NULL 时使用 stdio）
+  struct Ring *ring;       // 初始化时所在线程的 Ring
+  uint64 *spare;           // 后备缓存区，与 st 轮换使用
+  struct Ring_request req; // spare 上的写请求
+  long long req_len;       // 该写请求的字节数
+  long long req_offset;    // 该写请求的文件偏移
+  long long offset;        // 下一次写的文件偏移
+  int file_index;          // 在 ring 注册文件表中的下标
+  bool fixed;              // st 和 spare 是否位于 ring 的注册缓存区内
+
+  // 以下仅用于 O_DIRECT 后端（direct_fd 为 -1 时不使用）
+  // raw 的开头对应文件偏移 offset（按块对齐），不足一块的数据留在缓存区中，
+  // 直到凑满一块或在 del_output 时用 file 写出
+  int direct_fd;       // 以 O_DIRECT 打开的描述符，与 file 指向同一文件
+  uint64 *raw;         // 对齐缓存区，st 指向其中
+  long long raw_bytes; // raw 的字节数
+
+  // 以下仅在计算 CRC32C 时使用（crc_list 为 NULL 时不计算）
+  // 文件头之后的数据每 crc_block 字节为一块，del_output 时把各块的 CRC32C
+  // 写在数据之后
+  unsigned *crc_list;     // 已写完的各块的 CRC32C
+  long long crc_num;      // crc_list 中的个数
+  long long crc_capacity; // crc_list 的容量
+  long long crc_block;    // 每块的字节数
+  long long crc_fill;     // 当前块已写入的字节数
+  unsigned crc;           // 当前块的 CRC32C
+  long long data_bytes;   // 已写入的数据字节数（不含文件头）
+
+  bool failed; // 是否有写出失败，由 del_output 返回
 };
 
 /**
@@ -164,12 +824,117 @@ void init_output(struct Output *buffer, long long size, int n,
                  const char *file_name) {
   size = min64(size, MAX_PER_IO_BUFFER_SIZE);
   size = ((size >> 3) / n + 1) * n;
-  buffer->st = (uint64 *)malloc(size << 3);
+  file_create(file_name);
+  buffer->file = fopen(file_name, "wb");
+  buffer->crc_list = NULL;
+  buffer->failed = false;
+  buffer->direct_fd = options.direct ? open_direct(file_name, O_WRONLY) : -1;
+  track_fd(fileno(buffer->file), file_name);
+  track_fd(buffer->direct_fd, file_name);
+  buffer->ring =
+      options.io_uring && buffer->direct_fd < 0 ? get_ring() : NULL;
+  if (buffer->direct_fd >= 0) {
+    buffer->raw_bytes = (size << 3) + 2 * DIRECT_ALIGN;
+    buffer->raw = (uint64 *)pool_alloc(buffer->raw_bytes);
+    buffer->st = buffer->raw;
+    buffer->offset = 0;
+  } else if (buffer->ring != NULL) {
+    buffer->fixed =
+        alloc_ring_buffers(buffer->ring, size, &buffer->st, &buffer->spare);
+    buffer->file_index = ring_register_file(buffer->ring, fileno(buffer->file));
+    buffer->req.state = 0;
+    buffer->offset = 0;
+  } else
+    buffer->st = (uint64 *)pool_alloc(size << 3);
   buffer->ed = buffer->st + size;
   buffer->p = buffer->st;
+}
 
-  file_create(file_name);
-  buffer->file = fopen(file_name, "wb");
+/**
+ * @brief 让 Output 为之后写入的数据计算 CRC32C，每 block 字节一块。
+ * 需要在写入文件头之后、写入数据之前调用。
+ * @param buffer 指向 Output 的指针
+ * @param block 每块的字节数
+ * @return NULL
+ */
+void enable_output_crc(struct Output *buffer, long long block) {
+  buffer->crc_capacity = 16;
+  buffer->crc_list = (unsigned *)malloc(buffer->crc_capacity * 4);
+  buffer->crc_num = 0;
+  buffer->crc_block = block;
+  buffer->crc_fill = 0;
+  buffer->crc = 0;
+  buffer->data_bytes = 0;
+}
+
+void push_output_crc(struct Output *buffer) {
+  if (buffer->crc_num == buffer->crc_capacity) {
+    buffer->crc_capacity <<= 1;
+    buffer->crc_list = (unsigned *)realloc(buffer->crc_list,
+                                           buffer->crc_capacity * 4);
+  }
+  buffer->crc_list[buffer->crc_num++] = buffer->crc;
+  buffer->crc = 0;
+  buffer->crc_fill = 0;
+}
+
+/**
+ * @brief 把即将写出的 len 字节计入 CRC32C。
+ * @return NULL
+ */
+void feed_output_crc(struct Output *buffer, const char *data, long long len) {
+  buffer->data_bytes += len;
+  while (len > 0) {
+    const long long k = min64(len, buffer->crc_block - buffer->crc_fill);
+    buffer->crc = evenodd_crc32c(buffer->crc, data, k);
+    buffer->crc_fill += k;
+    data += k;
+    len -= k;
+    if (buffer->crc_fill == buffer->crc_block)
+      push_output_crc(buffer);
+  }
+}
+
+/**
+ * @brief 把各块的 CRC32C 写在数据之后。需要在数据全部写出之后调用。
+ * @return NULL
+ */
+void finish_output_crc(struct Output *buffer) {
+  if (buffer->crc_list == NULL)
+    return;
+  if (buffer->crc_fill > 0)
+    push_output_crc(buffer);
+  fflush(buffer->file);
+  buffer->failed |=
+      !pwrite_full(fileno(buffer->file), buffer->crc_list,
+                   buffer->crc_num * 4, 8 + buffer->data_bytes);
+  free(buffer->crc_list);
+  buffer->crc_list = NULL;
+}
+
+/**
+ * @brief 等待 Output 上在途的写请求完成。
+ * 必须在发起写请求的线程中调用。写得不完整时同步写完剩余部分，
+ * 仍然失败时记入 buffer->failed。
+ * @param buffer 指向 Output 的指针
+ * @return 该写请求是否全部写出
+ */
+bool sync_output(struct Output *buffer) {
+  if (buffer->ring == NULL || buffer->req.state == 0)
+    return true;
+
+  const int last = enter_phase(PHASE_WRITE);
+  long long done = ring_wait(&buffer->req);
+  done = done < 0 ? 0 : done;
+  count_io(PHASE_WRITE, fileno(buffer->file), done);
+  enter_phase(last);
+  if (done < buffer->req_len && // 写得不完整时同步写完
+      !pwrite_full(fileno(buffer->file), (char *)buffer->spare + done,
+                   buffer->req_len - done, buffer->req_offset + done)) {
+    buffer->failed = true;
+    return false;
+  }
+  return true;
 }
 
 /**
@@ -179,97 +944,518 @@ void init_output(struct Output *buffer, long long size, int n,
  * @return NULL
  */
 void flush_output(struct Output *buffer) {
-  fwrite(buffer->st, 1, (buffer->p - buffer->st) << 3, buffer->file);
+  add_stat(&stats->output_flushes, 1);
+  if (buffer->crc_list != NULL)
+    feed_output_crc(buffer, (char *)buffer->st,
+                    (char *)buffer->p - (char *)buffer->st);
+  if (buffer->direct_fd >= 0) { // 写出完整的块，剩余部分移到 raw 开头
+    const long long size = buffer->ed - buffer->st;
+    const long long len = (char *)buffer->p - (char *)buffer->raw;
+    const long long body = len / DIRECT_ALIGN * DIRECT_ALIGN;
+
+    buffer->failed |=
+        !pwrite_full(buffer->direct_fd, buffer->raw, body, buffer->offset);
+    memmove(buffer->raw, (char *)buffer->raw + body, len - body);
+    buffer->offset += body;
+    buffer->st = (uint64 *)((char *)buffer->raw + (len - body));
+    buffer->ed = buffer->st + size;
+    buffer->p = buffer->st;
+    return;
+  }
+  if (buffer->ring != NULL) { // 异步写出 st，换用 spare 继续填充
+    const long long size = buffer->ed - buffer->st;
+    uint64 *tmp = buffer->st;
+
+    if (buffer->p == buffer->st)
+      return;
+    sync_output(buffer);
+    buffer->req_len = (buffer->p - buffer->st) << 3;
+    buffer->req_offset = buffer->offset;
+    submit_ring_request(buffer->ring, &buffer->req, true, buffer->file,
+                        buffer->file_index, buffer->st, buffer->fixed,
+                        buffer->req_len, buffer->req_offset);
+    buffer->offset += buffer->req_len;
+    buffer->st = buffer->spare;
+    buffer->spare = tmp;
+    buffer->ed = buffer->st + size;
+    buffer->p = buffer->st;
+    return;
+  }
+  buffer->failed |= !fwrite_counted(
+      buffer->st, (buffer->p - buffer->st) << 3, buffer->file);
   buffer->p = buffer->st;
 }
 
 /**
  * @brief 销毁 Output（会自动输出缓存区）。
  * @param buffer 指向 Output 的指针
- * @return NULL
+ * @return 写入的内容是否全部写出（任何一次写出失败或 fclose 失败时为 false）
  */
-void del_output(struct Output *buffer) {
+bool del_output(struct Output *buffer) {
   flush_output(buffer);
-  fclose(buffer->file);
-  free(buffer->st);
-  buffer->st = buffer->ed = buffer->p = NULL;
+  if (buffer->direct_fd >= 0) { // 末尾不足一块的部分经页缓存写出
+    buffer->failed |=
+        !pwrite_full(fileno(buffer->file), buffer->raw,
+                     (char *)buffer->p - (char *)buffer->raw, buffer->offset);
+    finish_output_crc(buffer);
+    close(buffer->direct_fd);
+    pool_free(buffer->raw, buffer->raw_bytes);
+    buffer->st = buffer->ed = buffer->p = buffer->raw = NULL;
+  } else if (buffer->ring != NULL) {
+    sync_output(buffer);
+    finish_output_crc(buffer);
+    ring_unregister_file(buffer->ring, buffer->file_index);
+    free_ring_buffers(buffer->ring, buffer->fixed, buffer->st, buffer->spare);
+    buffer->st = buffer->ed = buffer->p = buffer->spare = NULL;
+  } else {
+    finish_output_crc(buffer);
+    pool_free(buffer->st, (buffer->ed - buffer->st) << 3);
+    buffer->st = buffer->ed = buffer->p = NULL;
+  }
+  buffer->failed |= ferror(buffer->file) != 0;
+  buffer->failed |= fclose(buffer->file) != 0;
   buffer->file = NULL;
+  return !buffer->failed;
 }
 
+/*
+ * O_DIRECT 后端中，write_uint64_direct / write_bytes_direct 写出的数据
+ * 同样先放进缓存区（位于 st 之前），以保持后续写出按块对齐。
+ */
 void write_uint64_direct(struct Output *buffer, uint64 x) {
-  fwrite(&x, 1, 8, buffer->file);
+  if (buffer->direct_fd >= 0) {
+    const long long size = buffer->ed - buffer->st;
+
+    flush_output(buffer);
+    *(buffer->p++) = x;
+    buffer->st = buffer->p;
+    buffer->ed = buffer->st + size;
+    return;
+  }
+  if (buffer->ring != NULL) {
+    buffer->failed |= !pwrite_full(fileno(buffer->file), &x, 8, buffer->offset);
+    buffer->offset += 8;
+    return;
+  }
+  buffer->failed |= !fwrite_counted(&x, 8, buffer->file);
 }
+/**
+ * @brief 写出 x 的低 n 字节，之后不能再写入。
+ * @return NULL
+ */
 void write_bytes_direct(struct Output *buffer, uint64 x, int n) {
+  if (buffer->direct_fd >= 0) {
+    flush_output(buffer);
+    memcpy(buffer->p, &x, n);
+    buffer->failed |=
+        !pwrite_full(fileno(buffer->file), buffer->raw,
+                     (char *)buffer->p - (char *)buffer->raw + n,
+                     buffer->offset);
+    buffer->offset += (char *)buffer->p - (char *)buffer->raw + n;
+    buffer->st = buffer->p = buffer->raw;
+    return;
+  }
+  if (buffer->ring != NULL) {
+    buffer->failed |= !pwrite_full(fileno(buffer->file), &x, n, buffer->offset);
+    buffer->offset += n;
+    return;
+  }
+  const int last = enter_phase(PHASE_WRITE);
+  count_io(PHASE_WRITE, fileno(buffer->file), n);
   while (n--) {
     fputc(x & 255, buffer->file);
     x >>= 8;
   }
+  enter_phase(last);
 }
 void write_array_unsafe(struct Output *buffer, uint64 *a, int n) {
   memcpy(buffer->p, a, n << 3);
   buffer->p += n;
 }
 
-void get_info(const char *file_path, long long *file_size, int *p) {
-  FILE *file;
-  uint64 x;
-
-  file = fopen(file_path, "rb");
-  fread(&x, 1, 8, file);
-  *file_size = x >> 8;
-  *p = x & 255;
+/**
+ * @brief 绕过缓存区，把 iov 中的 cnt 段数据依次写在 Output 已写出的内容之后。
+ * 仅用于 stdio 后端：先写出缓存区和 FILE 中的内容，使文件位置与描述符一致，
+ * 再直接用 writev 写出。
+ * @param buffer 指向 Output 的指针
+ * @param iov 各段数据，写得不完整时会被修改
+ * @param cnt 段数
+ * @return 是否全部写出（失败时同时记入 buffer->failed）
+ */
+bool write_output_iov(struct Output *buffer, struct iovec *iov, int cnt) {
+  flush_output(buffer);
+  fflush(buffer->file);
+  if (buffer->crc_list != NULL)
+    for (int i = 0; i < cnt; i++)
+      feed_output_crc(buffer, (char *)iov[i].iov_base, iov[i].iov_len);
+  buffer->failed |= !writev_full(fileno(buffer->file), iov, cnt);
+  return !buffer->failed;
+}
+
+void get_info(const char *file_path, struct File_info *info) {
+  FILE *file;
+  uint64 x;
+
+  file = fopen(file_path, "rb");
+  track_fd(fileno(file), file_path);
+  fread_counted(&x, 8, file);
+  parse_header(x, info);
   fclose(file);
 }
 
-#define CALC_PP1(res)                                                          \
-  {                                                                            \
-    uint64 _b1[2 * p - 1];                                                     \
-    memset(_b1, 0, sizeof(_b1));                                               \
-    for (int _i = 0; _i < p; _i++)                                             \
-      for (int _j = 0; _j < p - 1; _j++)                                       \
-        _b1[_i + _j] ^= a[_i][_j];                                             \
-    for (int _i = 0; _i < p - 1; _i++)                                         \
-      res[_i] = _b1[_i] ^ _b1[p - 1] ^ _b1[_i + p];                            \
-  }
-#define CALC_DIAG(res)                                                         \
-  {                                                                            \
-    uint64 _b1[2 * p - 1];                                                     \
-    memset(_b1, 0, sizeof(_b1));                                               \
-    for (int _i = 0; _i < p; _i++)                                             \
-      for (int _j = 0; _j < p - 1; _j++)                                       \
-        _b1[_i + _j] ^= a[_i][_j];                                             \
-    for (int _i = 0; _i < p - 1; _i++)                                         \
-      res[_i] = _b1[_i] ^ _b1[_i + p];                                         \
-    res[p - 1] = _b1[p - 1];                                                   \
-  }
-#define CALC_P(res)                                                            \
-  {                                                                            \
-    memset(res, 0, sizeof(res));                                               \
-    for (int _i = 0; _i < p; _i++)                                             \
-      for (int _j = 0; _j < p - 1; _j++)                                       \
-        res[_j] ^= a[_i][_j];                                                  \
-  }
-#define CALC_I(res)                                                            \
-  {                                                                            \
-    memset(res, 0, sizeof(res));                                               \
-    for (int _i = 0; _i < p + 1; _i++)                                         \
-      if (check_disk[_i])                                                      \
-        for (int _j = 0; _j < p - 1; _j++)                                     \
-          res[_j] ^= a[_i][_j];                                                \
+/*
+ * CRC32C 文件尾：每列的条带数据按 crc_block_stripes() 个条带分块（每块约
+ * CRC_BLOCK_BYTES 字节，元素较大时每个条带一块），各块的 CRC32C 依次存放在
+ * 该列数据之后，每个 4 字节。
+ */
+const int CRC_BATCH_BYTES = 1 << 22; // 重新计算 CRC32C 时每次读入的字节数
+
+/**
+ * @brief 检查一列中条带 [t0, t1) 的数据（data，t0 须为块的开头）。
+ * @param fd 列文件
+ * @param bad 结果：第 t0 / B + b 块损坏时 bad[b] 为 true
+ * @return 是否全部完好
+ */
+bool verify_crc_blocks(int fd, const struct File_info *info, const char *data,
+                       long long t0, long long t1, bool *bad) {
+  const long long block = crc_block_stripes(info);
+  const long long column_bytes = 8LL * (get_prime(info) - 1) * info->w;
+  const long long first = t0 / block, last = (t1 + block - 1) / block;
+  unsigned crc[last - first];
+  bool ok = true;
+
+  pread_full(fd, crc, (last - first) * 4,
+             8 + get_stripe_num(info) * column_bytes + first * 4);
+  for (long long b = first; b < last; b++) {
+    const long long st = b * block, ed = min64(t1, st + block);
+    bad[b - first] = evenodd_crc32c(0, data + (st - t0) * column_bytes,
+                                    (ed - st) * column_bytes) != crc[b - first];
+    ok &= !bad[b - first];
+  }
+  return ok;
+}
+
+/**
+ * @brief 重新计算一列中第 [first, last) 块的 CRC32C 并写入文件尾。
+ * @param fd 列文件，需要可读写
+ * @return 是否全部写出
+ */
+bool write_crc_blocks(int fd, const struct File_info *info, long long first,
+                      long long last) {
+  const long long block = crc_block_stripes(info);
+  const long long stripe_num = get_stripe_num(info);
+  const long long column_bytes = 8LL * (get_prime(info) - 1) * info->w;
+  const long long batch = max64(1, CRC_BATCH_BYTES / (block * column_bytes));
+  char *data = (char *)malloc(batch * block * column_bytes);
+  unsigned crc[batch];
+  bool ok = true;
+
+  last = min64(last, (stripe_num + block - 1) / block);
+  for (long long b0 = first; b0 < last; b0 += batch) {
+    const long long b1 = min64(last, b0 + batch);
+    const long long t0 = b0 * block, t1 = min64(stripe_num, b1 * block);
+
+    pread_full(fd, data, (t1 - t0) * column_bytes, 8 + t0 * column_bytes);
+    for (long long b = b0; b < b1; b++) {
+      const long long st = b * block, ed = min64(t1, st + block);
+      crc[b - b0] = evenodd_crc32c(0, data + (st - t0) * column_bytes,
+                                   (ed - st) * column_bytes);
+    }
+    ok &= pwrite_full(fd, crc, (b1 - b0) * 4,
+                      8 + stripe_num * column_bytes + b0 * 4);
+  }
+  free(data);
+  return ok;
+}
+
+#define SYM(x, j) ((x) + (long long)(j)*w) // 列 x 的第 j 个元素
+
+const long long PARALLEL_REPAIR_MIN_BYTES =
+    1LL << 24; // 单个文件的数据不少于此字节数时才按条带区间并行修复
+const long long REPAIR_RANGE_BYTES = 1LL << 23; // 每个线程至少分到的字节数
+const int REPAIR_CHUNK_BYTES = 1 << 22; // 每个线程每次读入的字节数（不严格）
+const int HYBRID_MIN_ELEMENT_BYTES = 4096; // 元素不小于此字节数时使用混合修复
+
+/**
+ * @brief 按条带区间并行修复一个文件时的共享信息。
+ * 各线程用 preadv / pwritev 按偏移读写，互不干扰。
+ */
+struct Repair_plan {
+  int p, q, w, n; // q 为编码使用的质数
+  struct Codec codec;
+  const struct Decode_plan *decode; // 损坏列对应的解码计划
+  const bool *check_disk;
+  const int *idx;
+  int number_erasures;
+  const int *fd;        // 各列文件的描述符
+  const int *direct_fd; // 损坏列以 O_DIRECT 打开的描述符，NULL 表示不使用
+  const struct File_info *info;
+  const bool *by_row; // 混合修复时各行是否按行修复，NULL 表示不使用混合修复
+  const bool *need;   // 混合修复时每个条带需要读入的元素
+};
+
+/**
+ * @brief 能否用混合修复（见 plan_hybrid_repair）修复文件。
+ * 只有一个数据列损坏时，按行和按对角线各修复一部分行可以少读约 1/4 的
+ * 元素；但只读部分元素要按元素分段读，元素小于一页时省不下磁盘读，
+ * 所以只用于较大的元素。
+ * @return 是否使用
+ */
+bool use_hybrid_repair(const struct File_info *info, const int number_erasures,
+                       const int *idx) {
+  return number_erasures == 1 && idx[0] < info->p &&
+         8LL * info->w >= HYBRID_MIN_ELEMENT_BYTES;
+}
+
+/**
+ * @brief 混合修复时读入第 i 列中条带 [t, t + k) 里计划需要的元素。
+ * 每个条带中连续的一段元素用一次 pread 读入条带缓存中对应的位置。
+ * @param a 各条带的缓存，每个条带 stripe_words 个 uint64
+ * @param raw 使用 O_DIRECT 时的对齐缓存区，否则为 NULL
+ * @return NULL
+ */
+void read_needed_elements(const struct Repair_plan *plan, const int i,
+                          uint64 *a, const long long stripe_words,
+                          const long long t, const int k, char *raw) {
+  const int rows = plan->q - 1, w = plan->w, n = plan->n;
+  const bool *need = plan->need + (long long)i * rows;
+
+  for (int s = 0; s < k; s++) {
+    uint64 *dst = a + s * stripe_words + (long long)i * plan->q * w;
+
+    for (int r = 0, e; r < rows; r = e) {
+      for (e = r; e < rows && need[e] == need[r]; e++)
+        ;
+      if (!need[r])
+        continue;
+      const long long len = (long long)(e - r) * w << 3;
+      const long long offset = 8 + ((t + s) * n + (long long)r * w) * 8;
+      if (raw != NULL)
+        memcpy(SYM(dst, r), pread_aligned(plan->fd[i], raw, len, offset), len);
+      else
+        pread_full(plan->fd[i], SYM(dst, r), len, offset);
+    }
+  }
+}
+
+struct Repair_range {
+  const struct Repair_plan *plan;
+  long long first, last; // 负责的条带区间 [first, last)
+  bool ok;               // 结果：修复的数据是否全部写出
+};
+
+/**
+ * @brief 修复 [first, last) 区间内的条带。
+ * 每次读入 k 个条带：用 preadv 把每列的 k 段数据分散读到各条带的缓存中，
+ * 解码后再用 pwritev 把损坏的列写回对应偏移。
+ * 使用 O_DIRECT 时改为经对齐缓存区整段读写，再在其中分散 / 收集。
+ * 写出失败时记入 range->ok 并停止。
+ */
+void *repair_range(void *arg) {
+  struct Repair_range *range = (struct Repair_range *)arg;
+  const struct Repair_plan *plan = range->plan;
+  const int p = plan->p, q = plan->q, w = plan->w, n = plan->n;
+  const struct Codec codec = plan->codec;
+  const long long stripe_words = (long long)(p + 2) * q * w; // 每个条带的缓存
+  const int chunk = max64(1, min64(MAX_IOV_NUM, REPAIR_CHUNK_BYTES /
+                                                (stripe_words << 3)));
+  uint64 *a = (uint64 *)calloc(chunk * stripe_words + (2 * q + 1) * w, 8);
+  uint64 *work = a + chunk * stripe_words;
+  uint64 *col[p + 2];
+  struct iovec iov[chunk];
+  const long long raw_bytes = ((long long)chunk * n << 3) + 2 * DIRECT_ALIGN;
+  char *raw = plan->direct_fd != NULL ? (char *)pool_alloc(raw_bytes) : NULL;
+
+  range->ok = true;
+  for (long long t = range->first; range->ok && t < range->last; t += chunk) {
+    const int k = min64(chunk, range->last - t);
+    const long long offset = 8 + t * n * 8; // 跳过文件头
+
+    for (int i = 0; i < p + 2; i++) {
+      if (!plan->check_disk[i])
+        continue;
+      if (plan->need != NULL) {
+        read_needed_elements(plan, i, a, stripe_words, t, k, raw);
+        continue;
+      }
+      if (raw != NULL) {
+        char *data = pread_aligned(plan->fd[i], raw, (long long)k * n << 3,
+                                   offset);
+        for (int s = 0; s < k; s++)
+          memcpy(a + s * stripe_words + (long long)i * q * w,
+                 data + ((long long)s * n << 3), (long long)n << 3);
+        continue;
+      }
+      for (int s = 0; s < k; s++) {
+        iov[s].iov_base = a + s * stripe_words + (long long)i * q * w;
+        iov[s].iov_len = (long long)n << 3;
+      }
+      pread_iov(plan->fd[i], iov, k, offset);
+    }
+
+    for (int s = 0; s < k; s++) {
+      for (int i = 0; i < p + 2; i++) {
+        col[i] = a + s * stripe_words + (long long)i * q * w;
+        if (!plan->check_disk[i])
+          memset(col[i], 0, (long long)q * w << 3);
+      }
+      if (plan->by_row != NULL)
+        decode_hybrid(plan->info, col, plan->idx[0], plan->by_row);
+      else
+        codec.decode(col, plan->decode, work, p, w);
+    }
+
+    for (int e = 0; e < plan->number_erasures; e++) {
+      const int i = plan->idx[e];
+      if (raw != NULL) {
+        char *data = raw + offset % DIRECT_ALIGN;
+        for (int s = 0; s < k; s++)
+          memcpy(data + ((long long)s * n << 3),
+                 a + s * stripe_words + (long long)i * q * w,
+                 (long long)n << 3);
+        range->ok &= pwrite_unaligned(plan->direct_fd[i], plan->fd[i], raw,
+                                      (long long)k * n << 3, offset);
+        continue;
+      }
+      for (int s = 0; s < k; s++) {
+        iov[s].iov_base = a + s * stripe_words + (long long)i * q * w;
+        iov[s].iov_len = (long long)n << 3;
+      }
+      range->ok &= pwrite_iov(plan->fd[i], iov, k, offset) ==
+                   (long long)k * n << 3;
+    }
+  }
+  pool_free(raw, raw_bytes);
+  free(a);
+  return NULL;
+}
+
+/**
+ * @brief 把文件的条带分成若干区间，用多个线程并行修复。
+ * @param file_name 需要修复的文件名
+ * @param info 该文件的文件头信息
+ * @param check_disk 为 true 表示该列完好
+ * @param idx 损坏列的编号
+ * @param number_erasures 损坏列数
+ * @param thread_num 线程数
+ * @return 能否打开各列文件，且修复的数据全部写出
+ */
+bool repair_work_parallel(const char *file_name, const struct File_info *info,
+                          const bool *check_disk, const int *idx,
+                          const int number_erasures, const int thread_num) {
+  const int p = info->p;
+  struct Repair_plan plan;
+  int fd[p + 2], direct_fd[p + 2];
+  char disk_file_name[MAX_FILE_NAME_LENGTH];
+  const uint64 header = make_header(info);
+  bool ok = true;
+
+  plan.p = p;
+  plan.q = get_prime(info);
+  plan.w = info->w;
+  plan.n = (plan.q - 1) * info->w;
+  plan.codec = get_codec(info);
+  plan.decode = get_decode_plan(info, idx, number_erasures);
+  plan.check_disk = check_disk;
+  plan.idx = idx;
+  plan.number_erasures = number_erasures;
+  plan.fd = fd;
+  plan.direct_fd = options.direct ? direct_fd : NULL;
+  plan.info = info;
+  plan.by_row = plan.need = NULL;
+
+  bool by_row[plan.q - 1], need[(p + 2) * (plan.q - 1)];
+  if (use_hybrid_repair(info, number_erasures, idx)) {
+    plan_hybrid_repair(info, idx[0], by_row, need);
+    plan.by_row = by_row;
+    plan.need = need;
+  }
+
+  const long long stripe_num =
+      (info->file_size + 8LL * p * plan.n - 1) / (8LL * p * plan.n);
+
+  for (int i = 0; i < p + 2; i++)
+    fd[i] = direct_fd[i] = -1;
+  for (int i = 0; i < p + 2 && ok; i++) {
+    sprintf(disk_file_name, "disk_%d/%s", i, file_name);
+    if (check_disk[i])
+      fd[i] = options.direct ? open_direct(disk_file_name, O_RDONLY)
+                             : open(disk_file_name, O_RDONLY);
+    else {
+      file_create(disk_file_name);
+      fd[i] = open(disk_file_name, info->crc ? O_RDWR : O_WRONLY);
+      if (options.direct)
+        direct_fd[i] = open_direct(disk_file_name, O_WRONLY);
+      track_fd(direct_fd[i], disk_file_name);
+      ok = fd[i] >= 0 && (!options.direct || direct_fd[i] >= 0) &&
+           pwrite_full(fd[i], &header, 8, 0);
+    }
+    ok &= fd[i] >= 0;
+    track_fd(fd[i], disk_file_name);
+  }
+
+  if (ok) {
+    pthread_t threads[thread_num];
+    struct Repair_range ranges[thread_num];
+
+    add_stat(&stats->stripes, stripe_num);
+    for (int i = 0; i < thread_num; i++) {
+      ranges[i].plan = &plan;
+      ranges[i].first = stripe_num * i / thread_num;
+      ranges[i].last = stripe_num * (i + 1) / thread_num;
+      create_thread(&threads[i], repair_range, &ranges[i]);
+    }
+    for (int i = 0; i < thread_num; i++) {
+      join_thread(threads[i]);
+      ok &= ranges[i].ok;
+    }
+  }
+
+  for (int i = 0; i < p + 2; i++) {
+    if (ok && !check_disk[i] && info->crc) // 修复完成后重新生成 CRC32C 文件尾
+      ok = write_crc_blocks(fd[i], info, 0, stripe_num);
+    if (fd[i] >= 0)
+      close(fd[i]);
+    if (direct_fd[i] >= 0)
+      close(direct_fd[i]);
+  }
+  return ok;
+}
+
+/**
+ * @brief 修复的数据写出失败：删除写了一半的列，之后的修复仍把它们当作损坏。
+ * @return false
+ */
+bool repair_failed(const char *file_name, const int *idx,
+                   const int number_erasures) {
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+
+  report("Write failed!\n");
+  for (int e = 0; e < number_erasures; e++) {
+    sprintf(disk_file_path, "disk_%d/%s", idx[e], file_name);
+    unlink(disk_file_path);
   }
+  return false;
+}
 
 /**
  * @brief 修复文件名为 file_name 的数据。
  * @param file_name 需要修复的文件名
- * @param size 该文件原来的大小
- * @param p 该文件对应的加密质数 p
+ * @param info 该文件的文件头信息（原文件大小、p、元素大小）
  * @param content_only 若为 true，则当损坏加密数据数不超过 2 且
  * 编号为 0 ... (p - 1) 的加密数据完好时直接退出，不进行修复
- * @return 损坏加密数据数是否不超过 2
- * @example repair_work("testfile", size, 5, false);
+ * options.threads > 1 且文件较大时，按条带区间多线程修复。
+ * @return 损坏加密数据数是否不超过 2，且修复的数据全部写出（写出失败时
+ * 见 repair_failed）
+ * @example repair_work("testfile", &info, false);
  */
-bool repair_work(const char *file_name, const long long size, const int p,
+bool repair_work(const char *file_name, const struct File_info *info,
                  bool content_only) {
+  const long long size = info->file_size;
+  const int p = info->p, q = get_prime(info), w = info->w;
+  const int n = (q - 1) * w; // 每个条带中每列的 uint64 个数
+  const struct Codec codec = get_codec(info);
+  const struct Decode_plan *plan;
   int number_erasures = 0;
   int idx[2], ok_id = 0;
   char disk_file_path[MAX_FILE_NAME_LENGTH];
@@ -290,29 +1476,49 @@ bool repair_work(const char *file_name, const long long size, const int p,
   if (number_erasures == 0 || (content_only && idx[0] >= p))
     return true;
 
+  const long long stripe_bytes = 8LL * p * n;
+  const long long data_bytes =
+      (size + stripe_bytes - 1) / stripe_bytes * stripe_bytes;
+  // 混合修复按偏移只读需要的元素，同样由 repair_work_parallel 完成
+  if (use_hybrid_repair(info, number_erasures, idx) ||
+      (options.threads > 1 && data_bytes >= PARALLEL_REPAIR_MIN_BYTES)) {
+    const int thread_num =
+        max64(1, min64(options.threads, data_bytes / REPAIR_RANGE_BYTES));
+    return repair_work_parallel(file_name, info, check_disk, idx,
+                                number_erasures, thread_num) ||
+           repair_failed(file_name, idx, number_erasures);
+  }
+
   struct Input input[p + 2];
   struct Output output[number_erasures];
-  uint64 a[p + 2][p]; // 0 ... (p + 1) 列的数据
+  plan = get_decode_plan(info, idx, number_erasures);
+  // 0 ... (p + 1) 列的数据，每列 q 个元素，之后为解码用的临时空间
+  uint64 *a = (uint64 *)malloc(((long long)(p + 2) * q + 2 * q + 1) * w << 3);
+  uint64 *col[p + 2];
   char disk_file_name[MAX_FILE_NAME_LENGTH];
   int now_output_id = 0;
 
   for (int i = 0; i < p + 2; i++) {
+    col[i] = SYM(a, (long long)i * q);
     sprintf(disk_file_name, "disk_%d/%s", i, file_name);
     if (check_disk[i]) {
-      init_input(&input[i], MAX_IO_BUFFER_SIZE_SUM / (p + 2), p - 1,
+      init_input(&input[i], MAX_IO_BUFFER_SIZE_SUM / (p + 2), n,
                  disk_file_name);
       read_uint64_direct(&input[i]);
       flush_input(&input[i]);
     } else {
       init_output(&output[now_output_id],
-                  min64(MAX_IO_BUFFER_SIZE_SUM / 2, size / p), p - 1,
+                  min64(MAX_IO_BUFFER_SIZE_SUM / 2, size / p), n,
                   disk_file_name);
-      write_uint64_direct(&output[now_output_id], size << 8 | p);
+      write_uint64_direct(&output[now_output_id], make_header(info));
+      if (info->crc)
+        enable_output_crc(&output[now_output_id],
+                          crc_block_stripes(info) * n * 8);
       now_output_id++;
     }
   }
 
-  for (long long t = 0; t < (size << 3); t += 64 * (p - 1) * p) {
+  for (long long t = 0; t < (size << 3); t += 64LL * n * p) {
     if (input[ok_id].p == input[ok_id].ed)
       for (int i = 0; i < p + 2; i++)
         if (check_disk[i])
@@ -320,291 +1526,2728 @@ bool repair_work(const char *file_name, const long long size, const int p,
 
     for (int i = 0; i < p + 2; i++)
       if (check_disk[i]) {
-        read_array_unsafe(a[i], &input[i], p - 1);
-        a[i][p - 1] = 0;
+        read_array_unsafe(col[i], &input[i], n);
+        memset(col[i] + n, 0, (long long)w << 3);
       } else
-        memset(a[i], 0, sizeof(a[i]));
-
-    if (number_erasures == 1) { // 1 个文件损坏
-      if (idx[0] == p)
-        CALC_P(a[p])
-      else if (idx[0] == p + 1)
-        CALC_PP1(a[p + 1])
-      else
-        CALC_I(a[idx[0]])
-      if (output[0].p == output[0].ed)
-        flush_output(&output[0]);
-      write_array_unsafe(&output[0], a[idx[0]], p - 1);
-
-    } else { // 2 个文件损坏
-      const int disk_i = idx[0], disk_j = idx[1];
-      if (disk_i == p && disk_j == p + 1) { // 相当于重新加密
-        CALC_P(a[p])
-        CALC_PP1(a[p + 1])
-      } else if (disk_i < p && disk_j == p) {
-        uint64 S[p]; // 对角线的 xor
-        uint64 t;
-        CALC_DIAG(S)
+        memset(col[i], 0, (long long)q * w << 3);
 
-        for (int l = 0; l < p - 1; l++)
-          S[l] ^= a[p + 1][l];
-
-        t = S[mod_p(disk_i - 1)];
-        for (int k = 0; k < p - 1; k++)
-          a[disk_i][k] = S[mod_p(disk_i + k - p)] ^ t;
-        CALC_P(a[p])
-      } else if (disk_i < p &&
-                 disk_j == p + 1) { // 由 a[p] 可以修复 disk_i 然后再求解 a[p+1]
-        CALC_I(a[disk_i])
-        CALC_PP1(a[p + 1])
-      } else if (disk_i < p && disk_j < p) {
-        uint64 S = 0;
-        uint64 S0[p], S1[p];
-
-        CALC_P(S0)
-        for (int l = 0; l <= p - 1; l++) {
-          S0[l] ^= a[p][l];
-          S ^= a[p][l] ^ a[p + 1][l];
-        }
+    codec.decode(col, plan, SYM(a, (long long)(p + 2) * q), p, w);
 
-        CALC_DIAG(S1)
-        for (int l = 0; l <= p - 1; l++)
-          S1[l] ^= S ^ a[p + 1][l];
-
-        const int ij = mod_p(disk_i - disk_j), ji = mod_p(disk_j - disk_i);
-        int s = mod_p(ij - 1);
-        do {
-          a[disk_j][s] = S1[mod_p(disk_j + s - p)] ^ a[disk_i][mod_p(s - ij)];
-          a[disk_i][s] = S0[s] ^ a[disk_j][s];
-          s = mod_p(s - ji);
-        } while (s != p - 1);
-      }
-      if (output[0].p == output[0].ed) {
-        flush_output(&output[0]);
-        flush_output(&output[1]);
-      }
-      write_array_unsafe(&output[0], a[disk_i], p - 1);
-      write_array_unsafe(&output[1], a[disk_j], p - 1);
-    }
+    if (output[0].p == output[0].ed)
+      for (int k = 0; k < number_erasures; k++)
+        flush_output(&output[k]);
+    for (int k = 0; k < number_erasures; k++)
+      write_array_unsafe(&output[k], col[idx[k]], n);
   }
 
   for (int i = 0; i < p + 2; i++)
     if (check_disk[i])
       del_input(&input[i]);
+  bool ok = true;
   for (int i = 0; i < number_erasures; i++)
-    del_output(&output[i]);
-  return true;
+    ok &= del_output(&output[i]);
+  free(a);
+  add_stat(&stats->stripes, data_bytes / stripe_bytes);
+  return ok || repair_failed(file_name, idx, number_erasures);
 }
 
 /**
- * @brief 读入文件 file_name，经 EVENODD 加密后储存。
- * 从文件 file_name 读入数据并编码，然后将 p + 2 个数据块储存在
- * "disk_0", "disk_1", ..., "disk_{p + 1}" 文件夹下。
- * @param file_name 文件名，长度不超过 100
- * @param p 用于 EVENODD 加密的质数，应当为不超过 100 的整数
- * @return NULL
- * @example write("testfile", 5);
+ * @brief 有界无锁队列（多生产者多消费者），元素为 int。
+ * 每个格子带一个序号，生产者 / 消费者用 CAS 抢占位置后，
+ * 通过序号的 release / acquire 交接数据。
  */
-void write(const char *file_name, const int p) {
-  struct Input input;
-  struct Output output[p + 2];
-  long long file_size;
-  uint64 a[p + 2][p - 1];
+struct Queue_cell {
+  atomic_llong seq;
+  int value;
+};
+struct Queue {
+  struct Queue_cell *cells;
+  long long mask;
+  atomic_llong head, tail; // 下一个出队 / 入队的位置
+};
 
-  file_size = get_file_stat(file_name).st_size;
+/**
+ * @brief 初始化 Queue，容量为不小于 capacity 的 2 的幂。
+ * @param queue 指向 Queue 的指针
+ * @param capacity 最小容量
+ * @return NULL
+ */
+void init_queue(struct Queue *queue, long long capacity) {
+  long long size = 1;
 
-  init_input(&input, file_size, p * (p - 1), file_name);
-  flush_input(&input);
+  while (size < capacity)
+    size <<= 1;
+  queue->cells = (struct Queue_cell *)malloc(size * sizeof(struct Queue_cell));
+  for (long long i = 0; i < size; i++)
+    atomic_init(&queue->cells[i].seq, i);
+  queue->mask = size - 1;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
 
-  for (int i = 0; i < p + 2; i++) {
-    char disk_file_name[MAX_FILE_NAME_LENGTH];
+void del_queue(struct Queue *queue) {
+  free(queue->cells);
+  queue->cells = NULL;
+}
 
-    sprintf(disk_file_name, "disk_%d/%s", i, file_name);
-    init_output(&output[i],
-                min64(MAX_IO_BUFFER_SIZE_SUM / (p + 2), file_size / p), p - 1,
-                disk_file_name);
+/**
+ * @brief 尝试入队。
+ * @return 队列已满时返回 false
+ */
+bool queue_try_push(struct Queue *queue, int value) {
+  long long pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  struct Queue_cell *cell;
 
-    // 先将文件大小和 p 的值输出
-    write_uint64_direct(&output[i], file_size << 8 | p);
+  while (true) {
+    cell = &queue->cells[pos & queue->mask];
+    long long dif =
+        atomic_load_explicit(&cell->seq, memory_order_acquire) - pos;
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0)
+      return false;
+    else
+      pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
   }
+  cell->value = value;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+  return true;
+}
 
-  // 开始加密
-  for (long long t = 0; t < (file_size << 3); t += 64 * (p - 1) * p) {
-    if (input.p == input.ed)
-      flush_input(&input);
-    for (int i = 0; i < p; i++)
-      read_array_unsafe(a[i], &input, p - 1);
-
-    CALC_P(a[p])
-    CALC_PP1(a[p + 1])
+/**
+ * @brief 尝试出队。
+ * @return 队列为空时返回 false
+ */
+bool queue_try_pop(struct Queue *queue, int *value) {
+  long long pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  struct Queue_cell *cell;
 
-    if (output[0].p == output[0].ed)
-      for (int i = 0; i < p + 2; i++)
-        flush_output(&output[i]);
-    for (int i = 0; i < p + 2; i++)
-      write_array_unsafe(&output[i], a[i], p - 1);
+  while (true) {
+    cell = &queue->cells[pos & queue->mask];
+    long long dif =
+        atomic_load_explicit(&cell->seq, memory_order_acquire) - (pos + 1);
+    if (dif == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if (dif < 0)
+      return false;
+    else
+      pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
   }
+  *value = cell->value;
+  atomic_store_explicit(&cell->seq, pos + queue->mask + 1,
+                        memory_order_release);
+  return true;
+}
 
-  del_input(&input);
-  for (int i = 0; i < p + 2; i++)
-    del_output(&output[i]);
+void queue_push(struct Queue *queue, int value) {
+  while (!queue_try_push(queue, value))
+    yield_idle();
 }
+int queue_pop(struct Queue *queue) {
+  int value;
 
-void read(const char *file_name, const char *save_as) {
-  long long file_size;
-  int p;
-  struct Output output;
-  char disk_file_path[MAX_FILE_NAME_LENGTH];
-  int disk_id;
-  int r, c;
-
-  disk_id = -1;
-  do {
-    disk_id++;
-    sprintf(disk_file_path, "disk_%d/%s", disk_id, file_name);
-  } while (disk_id < MAX_P + 1 && access(disk_file_path, 0) == -1);
-  if (access(disk_file_path, 0) == -1) {
-    printf("File does not exist!\n");
-    return;
-  } else if (disk_id >= 3) {
-    printf("File corrupted!\n");
-    return;
-  }
+  while (!queue_try_pop(queue, &value))
+    yield_idle();
+  return value;
+}
 
-  get_info(disk_file_path, &file_size, &p);
+const int PIPELINE_BATCH_BYTES = 1 << 22; // 每批数据的字节数（不严格）
+const int ENCODE_BLOCK_BYTES = 1 << 17; // 每次批量编码的数据字节数，放得进 L2
+const int PIPELINE_MAX_SLOTS = 64;        // 流水线中同时存在的批数上限
 
-  if (!repair_work(file_name, file_size, p, true)) {
-    printf("File corrupted!\n");
-    return;
-  }
+/**
+ * @brief 加密流水线中存放一批条带的缓存。
+ * 第 k 批固定使用第 k % slot_num 个 Slot，各写线程按批号顺序依次等待，
+ * 因此 Slot 环本身就是加密线程到写线程之间的有界队列，且输出顺序与单线程
+ * 加密完全相同。
+ */
+struct Slot {
+  uint64 *data;            // 读入的条带，每个条带 p * n 个 uint64
+  uint64 *columns;         // 编码后的 p + 2 列，每列 batch_stripes * n 个
+  int stripes;             // 本批的条带数
+  atomic_llong encoded;    // 已加密完成的批号，-1 表示无
+  atomic_int writers_left; // 还未写完本批的写线程数，为 0 时可复用
+};
 
-  struct Input input[p];
+/**
+ * @brief 加密流水线的共享状态。
+ * 读线程 --work--> 加密线程 --Slot 环--> 写线程（每个写线程负责若干列）。
+ */
+struct Pipeline {
+  struct Input *input;
+  struct Output *output;
+  int p, w, n;
+  struct Codec codec;
+  long long stripe_num, batch_num;
+  int batch_stripes; // 每批的条带数
+  int slot_num, writer_num;
+  struct Slot *slots;
+  struct Queue work; // 元素为批号，-1 表示结束
+};
 
-  for (int i = 0; i < p; i++) {
-    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
-    init_input(&input[i], MAX_IO_BUFFER_SIZE_SUM / p, p - 1, disk_file_path);
-    read_uint64_direct(&input[i]);
-    flush_input(&input[i]);
+struct Pipeline_writer {
+  struct Pipeline *pipeline;
+  int id;
+};
+
+void *pipeline_reader(void *arg) {
+  struct Pipeline *pl = (struct Pipeline *)arg;
+  long long stripes_left = pl->stripe_num;
+
+  for (long long k = 0; k < pl->batch_num; k++) {
+    struct Slot *slot = &pl->slots[k % pl->slot_num];
+
+    while (atomic_load_explicit(&slot->writers_left, memory_order_acquire))
+      yield_idle();
+    slot->stripes = min64(stripes_left, pl->batch_stripes);
+    stripes_left -= slot->stripes;
+    read_array_direct(slot->data, pl->input,
+                      (long long)slot->stripes * pl->p * pl->n);
+    atomic_store_explicit(&slot->writers_left, pl->writer_num,
+                          memory_order_relaxed);
+    queue_push(&pl->work, k);
   }
-  init_output(&output, file_size, p - 1, save_as);
+  return NULL;
+}
 
-  int i = 0;
-  while (file_size >= 8 * (p - 1)) {
-    if (input[0].ed == input[0].p)
-      for (i = 0; i < p; i++)
-        flush_input(&input[i]);
-    for (i = 0; i < p && file_size >= 8 * (p - 1); i++) {
-      if (output.ed == output.p)
-        flush_output(&output);
-      write_array_unsafe(&output, input[i].p, p - 1);
-      input[i].p += p - 1;
-      file_size -= 8 * (p - 1);
+void *pipeline_encoder(void *arg) {
+  struct Pipeline *pl = (struct Pipeline *)arg;
+  const int p = pl->p, n = pl->n;
+  const struct Codec codec = pl->codec;
+  const int block = max64(1, ENCODE_BLOCK_BYTES / (8LL * p * n));
+  uint64 *out[p + 2];
+  int k;
+
+  while ((k = queue_pop(&pl->work)) != -1) {
+    struct Slot *slot = &pl->slots[k % pl->slot_num];
+
+    for (int s = 0; s < slot->stripes; s += block) {
+      for (int i = 0; i < p + 2; i++)
+        out[i] = slot->columns + ((long long)i * pl->batch_stripes + s) * n;
+      codec.encode_batch(slot->data + (long long)s * p * n, out,
+                         min64(block, slot->stripes - s), p, pl->w);
     }
+    atomic_store_explicit(&slot->encoded, k, memory_order_release);
   }
-  i = i % p;
-  if (output.ed == output.p)
-    flush_output(&output);
-  if (input[i].ed == input[i].p)
-    flush_input(&input[i]);
-  write_array_unsafe(&output, input[i].p, file_size >> 3);
-  input[i].p += file_size >> 3;
-  flush_output(&output);
-  write_bytes_direct(&output, read_uint64_unsafe(&input[i]), file_size & 7);
+  return NULL;
+}
 
-  for (int i = 0; i < p; i++)
-    del_input(&input[i]);
-  del_output(&output);
+void *pipeline_writer(void *arg) {
+  struct Pipeline *pl = ((struct Pipeline_writer *)arg)->pipeline;
+  const int id = ((struct Pipeline_writer *)arg)->id;
+  const int p = pl->p, n = pl->n;
+
+  for (long long k = 0; k < pl->batch_num; k++) {
+    struct Slot *slot = &pl->slots[k % pl->slot_num];
+
+    while (atomic_load_explicit(&slot->encoded, memory_order_acquire) != k)
+      yield_idle();
+    for (int i = id; i < p + 2; i += pl->writer_num) {
+      struct Output *output = &pl->output[i];
+      uint64 *src = slot->columns + (long long)i * pl->batch_stripes * n;
+      long long left = (long long)slot->stripes * n;
+
+      while (left > 0) { // 本批中该列连续存放，按输出缓存区的剩余空间整段写入
+        if (output->p == output->ed)
+          flush_output(output);
+        const long long m = min64(left, output->ed - output->p);
+        write_array_unsafe(output, src, m);
+        src += m;
+        left -= m;
+      }
+    }
+    atomic_fetch_sub_explicit(&slot->writers_left, 1, memory_order_release);
+  }
+  for (int i = id; i < p + 2; i += pl->writer_num) { // 异步写必须在本线程等完
+    flush_output(&pl->output[i]);
+    sync_output(&pl->output[i]);
+  }
+  release_ring();
+  return NULL;
 }
 
 /**
- * @brief 修复加密数据文件夹
- * @param dir_path 要修复的文件夹路径
- * @return 是否成功修复
- * @example repair_directory("disk_1");
+ * @brief 多线程流水线加密。
+ * 一个读线程按批读入条带，options.threads 个加密线程计算校验列，
+ * 若干写线程按批号顺序把各列写入 output。结果与单线程加密逐字节相同。
+ * @param input 已打开的输入，尚未读入任何数据
+ * @param output p + 2 个已写好文件头的输出
+ * @param info 文件信息
+ * @return NULL
  */
-bool repair_directory(const char *dir_path) {
-  DIR *root;
-  struct dirent *sub_dir;
-  char sub_dir_path[MAX_FILE_NAME_LENGTH];
-  struct Input input;
-  long long file_size;
-  int p;
+void encode_pipeline(struct Input *input, struct Output *output,
+                     const struct File_info *info) {
+  struct Pipeline pl;
+  const int p = info->p;
+  const int encoder_num = options.threads;
 
-  root = opendir(dir_path);
-  while ((sub_dir = readdir(root)) != NULL) {
-    if (strcmp(sub_dir->d_name, ".") == 0 || strcmp(sub_dir->d_name, "..") == 0)
-      continue;
+  pl.input = input;
+  pl.output = output;
+  pl.p = p;
+  pl.w = info->w;
+  pl.n = (get_prime(info) - 1) * info->w;
+  pl.codec = get_codec(info);
+  pl.stripe_num = get_stripe_num(info);
+  pl.batch_stripes = max64(1, PIPELINE_BATCH_BYTES / (8LL * p * pl.n));
+  pl.batch_num = (pl.stripe_num + pl.batch_stripes - 1) / pl.batch_stripes;
+  pl.writer_num = min64(p + 2, options.threads);
+  pl.slot_num = min64(PIPELINE_MAX_SLOTS, 2 * (encoder_num + pl.writer_num));
+  pl.slot_num = max64(1, min64(pl.slot_num,
+                               MAX_IO_BUFFER_SIZE_SUM /
+                                   (8LL * pl.batch_stripes * (p + 2) * pl.n)));
+  pl.slots = (struct Slot *)malloc(pl.slot_num * sizeof(struct Slot));
+  for (int i = 0; i < pl.slot_num; i++) {
+    pl.slots[i].data =
+        (uint64 *)malloc(8LL * pl.batch_stripes * p * pl.n);
+    pl.slots[i].columns =
+        (uint64 *)malloc(8LL * pl.batch_stripes * (p + 2) * pl.n);
+    atomic_init(&pl.slots[i].encoded, -1);
+    atomic_init(&pl.slots[i].writers_left, 0);
+  }
+  init_queue(&pl.work, pl.slot_num + encoder_num);
 
-    sprintf(sub_dir_path, "%s/%s", dir_path, sub_dir->d_name);
+  pthread_t reader, encoders[encoder_num], writers[pl.writer_num];
+  struct Pipeline_writer writer_args[pl.writer_num];
 
-    if (sub_dir->d_type == DT_DIR) {
-      if (!repair_directory(sub_dir_path))
-        return false;
-    } else {
-      int pos = 0; // 找到第一个斜杆出现的下标
-      while (sub_dir_path[pos] != '/')
-        pos++;
+  create_thread(&reader, pipeline_reader, &pl);
+  for (int i = 0; i < encoder_num; i++)
+    create_thread(&encoders[i], pipeline_encoder, &pl);
+  for (int i = 0; i < pl.writer_num; i++) {
+    writer_args[i].pipeline = &pl;
+    writer_args[i].id = i;
+    create_thread(&writers[i], pipeline_writer, &writer_args[i]);
+  }
 
-      get_info(sub_dir_path, &file_size, &p);
+  join_thread(reader);
+  for (int i = 0; i < encoder_num; i++)
+    queue_push(&pl.work, -1);
+  for (int i = 0; i < encoder_num; i++)
+    join_thread(encoders[i]);
+  for (int i = 0; i < pl.writer_num; i++)
+    join_thread(writers[i]);
 
-      if (!repair_work(sub_dir_path + pos + 1, file_size, p,
-                       false)) // 此处 sub_dir_path + pos + 1 即为原文件路径
-        return false;
-    }
+  for (int i = 0; i < pl.slot_num; i++) {
+    free(pl.slots[i].data);
+    free(pl.slots[i].columns);
   }
-  closedir(root);
-  return true;
+  free(pl.slots);
+  del_queue(&pl.work);
 }
 
+const int ZERO_COPY_BATCH_BYTES = 1 << 22; // 零拷贝加密每批的字节数（不严格）
+const int ZERO_COPY_MIN_BYTES = 256; // 每列每个条带至少多少字节时使用零拷贝
+
 /**
- * @brief 已知损坏的文件夹个数 number_erasures 以及具体损坏文件夹的编号 idx,
- * 修复磁盘
- * @param number_erasures 损坏的文件夹个数，大于 2 时无法修复
- * @param idx 具体损坏文件夹的编号
- * @return NULL
- * @example repair(2, [0, 1]);
+ * @brief 能否使用 encode_zero_copy 加密。
+ * 数据列按条带分段写出，每段太短时内核逐段处理的开销超过省下的复制；
+ * 元素为 8 字节时 encode_batch 逐字计算校验列，仍然更快。
+ * @return 是否可以使用
  */
-void repair(const int number_erasures, const int *idx) {
-  if (number_erasures == 0)
-    return;
-  if (number_erasures > 2) {
-    printf("Too many corruptions!\n");
-    return;
-  }
+bool use_zero_copy(const struct File_info *info) {
+  return !options.io_uring && !options.direct && info->w > 1 &&
+         8LL * (get_prime(info) - 1) * info->w >= ZERO_COPY_MIN_BYTES;
+}
 
-  int disk_ok_id = 0; // 找到一个完整磁盘，以获取需要修复的文件名
+/**
+ * @brief 单线程零拷贝加密。
+ * 每批把若干条带直接读入同一个缓存区，数据列不再复制到输出缓存区，
+ * 而是用 writev 从该缓存区按条带分段写出；只有两个校验列经过 Output
+ * 的缓存区。仅用于 stdio 后端，结果与 encode_batch 逐字节相同。
+ * @param input 已打开的输入，尚未读入任何数据
+ * @param output p + 2 个已写好文件头的输出
+ * @param info 文件信息
+ * @return 数据列是否全部写出（写出失败时停止加密）
+ */
+bool encode_zero_copy(struct Input *input, struct Output *output,
+                      const struct File_info *info) {
+  const int p = info->p, w = info->w;
+  const int n = (get_prime(info) - 1) * w; // 每个条带中每列的 uint64 个数
+  const long long stripe_bytes = 8LL * p * n;
+  const long long stripe_num = get_stripe_num(info);
+  const int chunk =
+      max64(1, min64(MAX_IOV_NUM, ZERO_COPY_BATCH_BYTES / stripe_bytes));
+  const struct Codec codec = get_codec(info);
+  uint64 *data = (uint64 *)malloc(chunk * stripe_bytes);
+  uint64 *col[p + 2];
+  struct iovec iov[chunk];
+  bool ok = true;
 
-  // 这部分是求 mex
-  while (disk_ok_id == idx[0] || (number_erasures == 2 && disk_ok_id == idx[1]))
-    disk_ok_id++;
+  for (long long t = 0; ok && t < stripe_num; t += chunk) {
+    const int k = min64(chunk, stripe_num - t);
 
-  char disk_ok_name[MAX_FILE_NAME_LENGTH];
-  sprintf(disk_ok_name, "disk_%d", disk_ok_id);
-  if (!repair_directory(disk_ok_name)) {
-    printf("Too many corruptions!\n");
-    return;
+    pread_full(fileno(input->file), data, k * stripe_bytes, t * stripe_bytes);
+    for (int s = 0; s < k; s++) { // 校验列仍写进输出缓存区
+      if (output[p].p == output[p].ed) {
+        flush_output(&output[p]);
+        flush_output(&output[p + 1]);
+      }
+      for (int i = 0; i < p; i++)
+        col[i] = data + ((long long)s * p + i) * n;
+      col[p] = output[p].p;
+      col[p + 1] = output[p + 1].p;
+      codec.encode(col, p, w);
+      output[p].p += n;
+      output[p + 1].p += n;
+    }
+    for (int i = 0; i < p; i++) {
+      for (int s = 0; s < k; s++) {
+        iov[s].iov_base = data + ((long long)s * p + i) * n;
+        iov[s].iov_len = 8LL * n;
+      }
+      ok &= write_output_iov(&output[i], iov, k);
+    }
   }
+  free(data);
+  return ok;
 }
 
-void usage() {
-  printf("./evenodd write <file_name> <p>\n");
-  printf("./evenodd read <file_name> <save_as>\n");
-  printf("./evenodd repair <number_erasures> <idx0> ...\n");
+/**
+ * @brief 为 libevenodd 编码器在第 column 个 Output 的缓存区中留出 len 字节。
+ * arg 为 p + 2 个 Output 的数组。
+ * @return 缓存区中的位置，缓存区放不下时返回 NULL
+ */
+void *reserve_output_sink(void *arg, int column, long long len) {
+  struct Output *output = (struct Output *)arg + column;
+
+  if ((output->ed - output->p) << 3 < len)
+    flush_output(output);
+  return (output->ed - output->p) << 3 < len ? NULL : output->p;
 }
 
-int main(int argc, char **argv) {
-  // int id[]= {0};
-  // repair(1, id);
-  // return 0;
-  if (argc < 2) {
-    usage();
-    return -1;
-  }
+/**
+ * @brief 把 libevenodd 编码器写出的一段数据追加到第 column 个 Output。
+ * 数据位于 reserve_output_sink 留出的位置时只需移动 p。
+ * 不足 8 字节的尾部只能出现在最后。
+ * @return 是否成功
+ */
+bool write_output_sink(void *arg, int column, const void *data,
+                       long long len) {
+  struct Output *output = (struct Output *)arg + column;
+  const uint64 *src = (const uint64 *)data;
 
-  char *op = argv[1];
-  if (strcmp(op, "write") == 0) {
-    /*
-     * Please encode the input file with EVENODD code
+  if (src == output->p) {
+    output->p += len >> 3;
+    return true;
+  }
+  for (long long m; len >= 8; src += m, len -= m << 3) {
+    if (output->p == output->ed)
+      flush_output(output);
+    m = min64(len >> 3, output->ed - output->p);
+    write_array_unsafe(output, (uint64 *)src, m);
+  }
+  if (len > 0) { // CRC32C 文件尾的块数为奇数时剩下 4 字节
+    uint64 x = 0;
+    memcpy(&x, src, len);
+    flush_output(output);
+    write_bytes_direct(output, x, len);
+  }
+  return true;
+}
+
+/**
+ * @brief 单线程加密：把输入缓存区中的数据依次交给 libevenodd 的编码器，
+ * 编码器写出的各列（含文件头和 CRC32C 文件尾）经 write_output_sink 写入
+ * output。输入缓存区总是容纳整数个条带，只有最后一个条带需要暂存。
+ * @param input 已打开的输入，尚未读入任何数据
+ * @param output p + 2 个尚未写入任何内容的输出
+ * @param info 文件信息
+ * @return NULL
+ */
+void encode_stream(struct Input *input, struct Output *output,
+                   const struct File_info *info) {
+  const struct Evenodd_sink sink = {write_output_sink, reserve_output_sink,
+                                    output};
+  struct Evenodd_encoder *encoder = evenodd_encoder_new(info, sink);
+  const int n = (get_prime(info) - 1) * info->w;
+  const long long stripe_bytes = 8LL * info->p * n;
+
+  for (long long left = info->file_size, len; left > 0; left -= len) {
+    if (input->p == input->ed)
+      flush_input(input);
+    if (output[0].ed - output[0].p < n)
+      for (int i = 0; i < info->p + 2; i++)
+        flush_output(&output[i]);
+    // 每次交给编码器的条带都放得进输出缓存区的剩余空间，不会提前写出
+    len = min64(left, min64((input->ed - input->p) << 3,
+                            (output[0].ed - output[0].p) / n * stripe_bytes));
+    evenodd_encoder_write(encoder, input->p, len);
+    input->p += len >> 3;
+  }
+  evenodd_encoder_finish(encoder);
+  evenodd_encoder_free(encoder);
+}
+
+/*
+ * 每个 disk_i 下的清单 MANIFEST_NAME 记录该磁盘上存有列的所有文件，
+ * 每次 write 在末尾追加一行：
+ *   <CRC32C> <原文件大小> <p> <元素字节数> <标志> <文件路径>
+ * CRC32C 为十六进制，校验其后的内容，用于跳过写了一半的行。
+ * 标志的第 0 位表示是否有 CRC32C 文件尾，第 4 ... 7 位为编码方式，
+ * 与文件头的第 48 ... 55 位相同；p 为数据列数。
+ * 同一文件有多行时以最后一行为准。每个文件至少有 5 列（p >= 3），
+ * 所以 disk_0 ... disk_4 的清单都列出了全部文件。
+ */
+const char *MANIFEST_NAME = ".manifest";
+const int MIN_DISK_NUM = 5; // 每个文件至少有几列
+
+struct Manifest_entry {
+  char *line;       // 原始记录（不含换行）
+  const char *path; // 文件路径，位于 line 中
+  struct File_info info;
+  bool deleted; // 该文件的各列已被删除（改为打包储存）
+};
+
+/**
+ * @brief 读入内存的清单。
+ * entries 按追加顺序排列；files 为去重后的文件（同一路径取最后一行，
+ * 最后一行为删除记录的文件不在其中），按路径排序。
+ */
+struct Manifest {
+  char *text; // 清单文件的内容，各行的换行符被替换为 '\0'
+  struct Manifest_entry *entries;
+  long long size;
+  struct Manifest_entry **files;
+  long long file_num;
+};
+
+/*
+ * 清单等追加式记录文件中的一行（不含换行）以 8 位十六进制的 CRC32C 和
+ * 一个空格开头，CRC32C 校验从第 9 个字节开始的内容。
+ */
+const int RECORD_BODY = 9; // 记录内容在行中的偏移
+
+/**
+ * @brief 在 line 开头填上记录内容（line + 9 起的 body_len 字节）的 CRC32C。
+ * @return 整行的长度
+ */
+int seal_record(char *line, int body_len) {
+  char crc[9];
+
+  sprintf(crc, "%08x", evenodd_crc32c(0, line + RECORD_BODY, body_len));
+  memcpy(line, crc, 8);
+  line[8] = ' ';
+  return body_len + RECORD_BODY;
+}
+
+/**
+ * @brief 检查一行记录的 CRC32C。
+ * @return 记录是否完整
+ */
+bool check_record(const char *line) {
+  const int len = strlen(line);
+  unsigned crc;
+
+  return len >= RECORD_BODY && sscanf(line, "%8x", &crc) == 1 &&
+         evenodd_crc32c(0, line + RECORD_BODY, len - RECORD_BODY) == crc;
+}
+
+/**
+ * @brief 在记录文件 path 末尾追加一行（line 含换行，共 len 字节）。
+ * 一行由一次 write 写出，并发追加时不会交错。文件末尾有写了一半的行时
+ * 先补一个换行，使它与新记录分开。
+ * @return NULL
+ */
+void append_record(const char *path, const char *line, int len) {
+  char last = '\n';
+
+  int fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0666);
+  if (fd < 0) { // 所在的文件夹不存在
+    file_create(path);
+    fd = open(path, O_RDWR | O_APPEND);
+  }
+  if (fd < 0)
+    return;
+  flock(fd, LOCK_EX); // 多个线程 / 进程同时追加时，每条记录完整地写在一行
+  const long long bytes = lseek(fd, 0, SEEK_END);
+  if (bytes > 0)
+    pread(fd, &last, 1, bytes - 1);
+  if (last != '\n')
+    write(fd, "\n", 1);
+  write(fd, line, len);
+  close(fd);
+}
+
+/**
+ * @brief 生成一行清单记录（不含换行）。
+ * @param deleted 是否为删除记录
+ * @return 记录的长度
+ */
+int format_manifest_line(char *line, const char *file_name,
+                         const struct File_info *info, bool deleted) {
+  return seal_record(line, sprintf(line + RECORD_BODY, "%lld %d %d %d %s",
+                                   info->file_size, info->p, info->w * 8,
+                                   info->crc | deleted << 1 | info->code << 4,
+                                   file_name));
+}
+
+/**
+ * @brief 解析一行清单记录。
+ * @return 记录是否完整
+ */
+bool parse_manifest_line(char *line, struct Manifest_entry *entry) {
+  int element_size, flags, path_pos = 0;
+
+  if (!check_record(line) ||
+      sscanf(line + RECORD_BODY, "%lld %d %d %d %n", &entry->info.file_size,
+             &entry->info.p, &element_size, &flags, &path_pos) != 4 ||
+      path_pos == 0)
+    return false;
+  entry->line = line;
+  entry->path = line + RECORD_BODY + path_pos;
+  entry->info.w = element_size / 8;
+  entry->info.crc = flags & 1;
+  entry->deleted = flags >> 1 & 1;
+  entry->info.code = flags >> 4 & 15;
+  return true;
+}
+
+/**
+ * @brief 在 disk_{disk_id} 的清单末尾追加文件 file_name 的记录。
+ * @param deleted 为 true 时追加删除记录：该文件的各列已被删除
+ * @return NULL
+ */
+void append_manifest(int disk_id, const char *file_name,
+                     const struct File_info *info, bool deleted) {
+  char path[MAX_FILE_NAME_LENGTH], line[2 * MAX_FILE_NAME_LENGTH];
+  int len = format_manifest_line(line, file_name, info, deleted);
+
+  line[len++] = '\n';
+  sprintf(path, "disk_%d/%s", disk_id, MANIFEST_NAME);
+  append_record(path, line, len);
+}
+
+int compare_manifest_entry(const void *x, const void *y) {
+  const struct Manifest_entry *a = *(struct Manifest_entry *const *)x;
+  const struct Manifest_entry *b = *(struct Manifest_entry *const *)y;
+  const int r = strcmp(a->path, b->path);
+  return r != 0 ? r : (a > b) - (a < b);
+}
+
+/**
+ * @brief 读入 disk_{disk_id} 的清单。
+ * @return 清单是否存在
+ * @example if (load_manifest(0, &manifest)) ...
+ */
+bool load_manifest(int disk_id, struct Manifest *manifest) {
+  char path[MAX_FILE_NAME_LENGTH];
+  long long bytes, line_num = 0;
+
+  sprintf(path, "disk_%d/%s", disk_id, MANIFEST_NAME);
+  if (access(path, 0) == -1)
+    return false;
+  bytes = get_file_stat(path).st_size;
+  int fd = open(path, O_RDONLY);
+  track_fd(fd, path);
+  manifest->text = (char *)malloc(bytes + 1);
+  pread_full(fd, manifest->text, bytes, 0);
+  manifest->text[bytes] = '\0';
+  close(fd);
+
+  for (long long i = 0; i < bytes; i++)
+    line_num += manifest->text[i] == '\n';
+  manifest->entries = (struct Manifest_entry *)malloc(
+      (line_num + 1) * sizeof(struct Manifest_entry));
+  manifest->size = 0;
+  for (char *line = manifest->text, *end; *line; line = end + 1) {
+    end = strchr(line, '\n');
+    if (end == NULL) // 最后一行没有换行，是写了一半的记录
+      break;
+    *end = '\0';
+    if (parse_manifest_line(line, &manifest->entries[manifest->size]))
+      manifest->size++;
+  }
+
+  manifest->files = (struct Manifest_entry **)malloc(
+      (manifest->size + 1) * sizeof(struct Manifest_entry *));
+  for (long long i = 0; i < manifest->size; i++)
+    manifest->files[i] = &manifest->entries[i];
+  qsort(manifest->files, manifest->size, sizeof(struct Manifest_entry *),
+        compare_manifest_entry);
+  manifest->file_num = 0;
+  for (long long i = 0; i < manifest->size; i++) {
+    struct Manifest_entry *cur = manifest->files[i];
+    if ((i + 1 == manifest->size ||
+         strcmp(cur->path, manifest->files[i + 1]->path) != 0) &&
+        !cur->deleted)
+      manifest->files[manifest->file_num++] = cur;
+  }
+  return true;
+}
+
+/**
+ * @brief 在清单中按路径二分查找文件 file_name。
+ * @return 该文件的记录，不在清单中时返回 NULL
+ */
+const struct Manifest_entry *find_manifest_entry(
+    const struct Manifest *manifest, const char *file_name) {
+  long long lo = 0, hi = manifest->file_num;
+
+  while (lo < hi) {
+    const long long mid = (lo + hi) / 2;
+    const int r = strcmp(manifest->files[mid]->path, file_name);
+    if (r == 0)
+      return manifest->files[mid];
+    if (r < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+void del_manifest(struct Manifest *manifest) {
+  free(manifest->text);
+  free(manifest->entries);
+  free(manifest->files);
+}
+
+/**
+ * @brief 由其他磁盘的清单重建 disk_{disk_id} 的清单。
+ * 按原顺序写出在该磁盘上有列（p + 2 > disk_id）的记录，先写入临时文件再
+ * 替换，与该磁盘原来的清单逐字节相同。
+ * @return NULL
+ */
+void save_manifest(int disk_id, const struct Manifest *manifest) {
+  char path[MAX_FILE_NAME_LENGTH], tmp_path[MAX_FILE_NAME_LENGTH];
+  FILE *file;
+
+  sprintf(path, "disk_%d/%s", disk_id, MANIFEST_NAME);
+  sprintf(tmp_path, "%s.tmp", path);
+  file_create(tmp_path);
+  file = fopen(tmp_path, "wb");
+  for (long long i = 0; i < manifest->size; i++)
+    if (manifest->entries[i].info.p + 2 > disk_id)
+      fprintf(file, "%s\n", manifest->entries[i].line);
+  fclose(file);
+  rename(tmp_path, path);
+}
+
+/**
+ * @brief 找到 disk_0 ... disk_4 中第一个有清单的磁盘。
+ * @return 磁盘编号，都没有清单时返回 -1
+ */
+int find_manifest_disk() {
+  char path[MAX_FILE_NAME_LENGTH];
+
+  for (int i = 0; i < MIN_DISK_NUM; i++) {
+    sprintf(path, "disk_%d/%s", i, MANIFEST_NAME);
+    if (access(path, 0) == 0)
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * @brief 在 find_manifest_disk() 的清单中查找文件 file_name。
+ * 逐行扫描，不读入全部记录。
+ * @return 是否找到
+ */
+bool lookup_manifest(const char *file_name, struct File_info *info) {
+  char path[MAX_FILE_NAME_LENGTH], line[2 * MAX_FILE_NAME_LENGTH];
+  struct Manifest_entry entry;
+  bool found = false;
+  const int disk_id = find_manifest_disk();
+
+  if (disk_id < 0)
+    return false;
+  sprintf(path, "disk_%d/%s", disk_id, MANIFEST_NAME);
+  FILE *file = fopen(path, "rb");
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    *end = '\0';
+    if (parse_manifest_line(line, &entry) &&
+        strcmp(entry.path, file_name) == 0) {
+      *info = entry.info;
+      found = !entry.deleted;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/*
+ * 打包模式：小文件不单独加密，而是依次追加到共享的容器中。容器本身是普通
+ * 的加密数据（disk_i/.pack/p<p>_e<元素字节数>_<编号>），其原文件即各小文件
+ * 首尾相接。每个磁盘的 PACK_INDEX_DIR 下按文件路径的 CRC32C 分成
+ * PACK_INDEX_BUCKETS 个索引文件，每打包一个文件，在容器所在的 p + 2 个
+ * 磁盘上各追加一行记录：
+ *   <CRC32C> <p> <容器> <偏移> <长度> <文件路径>
+ * 同一文件有多行时以最后一行为准。长度为 -1 的记录表示该文件之后又以
+ * 普通方式写入，原来打包的内容已失效。
+ */
+const char *PACK_DIR = ".pack";
+const char *PACK_INDEX_DIR = ".pack_index";
+const int PACK_INDEX_BUCKETS = 64;
+const long long PACK_CONTAINER_BYTES = 1LL << 30; // 容器的最大字节数（不严格）
+const long long PACK_MAX_OBJECT_BYTES = 1 << 20; // 大于该大小的文件不打包
+
+struct Pack_entry {
+  int p;
+  char container[64]; // 容器名，形如 .pack/p5_e8_0
+  long long offset, length; // 文件在容器原文件中的区间
+};
+
+void pack_index_path(char *path, int disk_id, const char *file_name) {
+  sprintf(path, "disk_%d/%s/%02x", disk_id, PACK_INDEX_DIR,
+          evenodd_crc32c(0, file_name, strlen(file_name)) %
+              PACK_INDEX_BUCKETS);
+}
+
+/**
+ * @brief 解析一行索引记录。
+ * @param file_name 结果：文件路径，位于 line 中
+ * @return 记录是否完整
+ */
+bool parse_pack_line(char *line, struct Pack_entry *entry,
+                     const char **file_name) {
+  int path_pos = 0;
+
+  if (!check_record(line) ||
+      sscanf(line + RECORD_BODY, "%d %63s %lld %lld %n", &entry->p,
+             entry->container, &entry->offset, &entry->length,
+             &path_pos) != 4 ||
+      path_pos == 0)
+    return false;
+  *file_name = line + RECORD_BODY + path_pos;
+  return true;
+}
+
+void append_pack_index(int disk_id, const char *file_name,
+                       const struct Pack_entry *entry) {
+  char path[MAX_FILE_NAME_LENGTH], line[3 * MAX_FILE_NAME_LENGTH];
+  int len = seal_record(line, sprintf(line + RECORD_BODY, "%d %s %lld %lld %s",
+                                      entry->p, entry->container,
+                                      entry->offset, entry->length,
+                                      file_name));
+
+  line[len++] = '\n';
+  pack_index_path(path, disk_id, file_name);
+  append_record(path, line, len);
+}
+
+/**
+ * @brief 在索引中查找打包的文件 file_name。
+ * 使用 disk_0 ... disk_4 中第一个有索引的磁盘，只扫描对应的一个索引文件。
+ * @return 是否找到
+ */
+bool lookup_pack(const char *file_name, struct Pack_entry *entry) {
+  char path[MAX_FILE_NAME_LENGTH], line[3 * MAX_FILE_NAME_LENGTH];
+  struct Pack_entry cur;
+  const char *name;
+  bool found = false;
+  FILE *file = NULL;
+
+  for (int i = 0; i < MIN_DISK_NUM; i++) {
+    sprintf(path, "disk_%d/%s", i, PACK_INDEX_DIR);
+    if (access(path, 0) == 0) {
+      pack_index_path(path, i, file_name);
+      file = fopen(path, "rb");
+      break;
+    }
+  }
+  if (file == NULL)
+    return false;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *end = strchr(line, '\n');
+    if (end == NULL)
+      break;
+    *end = '\0';
+    if (parse_pack_line(line, &cur, &name) && strcmp(name, file_name) == 0) {
+      *entry = cur;
+      found = cur.length >= 0;
+    }
+  }
+  fclose(file);
+  return found;
+}
+
+/**
+ * @brief 由 disk_{disk_ok_id} 的索引重建 disk_{disk_id} 的索引。
+ * 按原顺序写出容器在该磁盘上有列（p + 2 > disk_id）的记录。
+ * @return NULL
+ */
+void save_pack_index(int disk_ok_id, int disk_id) {
+  char path[MAX_FILE_NAME_LENGTH], tmp_path[MAX_FILE_NAME_LENGTH];
+  char line[3 * MAX_FILE_NAME_LENGTH], copy[3 * MAX_FILE_NAME_LENGTH];
+  struct Pack_entry entry;
+  const char *name;
+
+  for (int b = 0; b < PACK_INDEX_BUCKETS; b++) {
+    sprintf(path, "disk_%d/%s/%02x", disk_ok_id, PACK_INDEX_DIR, b);
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+      continue;
+    sprintf(path, "disk_%d/%s/%02x", disk_id, PACK_INDEX_DIR, b);
+    sprintf(tmp_path, "%s.tmp", path);
+    file_create(tmp_path);
+    FILE *out = fopen(tmp_path, "wb");
+    while (fgets(line, sizeof(line), in) != NULL) {
+      char *end = strchr(line, '\n');
+      if (end == NULL)
+        break;
+      *end = '\0';
+      strcpy(copy, line);
+      if (parse_pack_line(copy, &entry, &name) && entry.p + 2 > disk_id)
+        fprintf(out, "%s\n", line);
+    }
+    fclose(out);
+    fclose(in);
+    rename(tmp_path, path);
+  }
+}
+
+/**
+ * @brief 同名文件原来是打包的时，使其索引记录失效。
+ * 在原记录所在的各磁盘上追加长度为 -1 的记录，之后 lookup_pack 找不到它。
+ * @return NULL
+ */
+void unpack_file(const char *file_name) {
+  struct Pack_entry entry;
+
+  if (!lookup_pack(file_name, &entry))
+    return;
+  entry.length = -1;
+  for (int i = 0; i < entry.p + 2; i++)
+    append_pack_index(i, file_name, &entry);
+}
+
+/**
+ * @brief 数据列数为 p、编码使用的质数为 prime 时允许的最大元素字节数。
+ * 编解码时每个条带的 p + 2 列需要同时放在内存中，合计不能超过
+ * MAX_IO_BUFFER_SIZE_SUM 字节，例如 p = 97 时元素最多 16384 字节。
+ */
+int max_element_size(const int p, const int prime) {
+  int size = MAX_ELEMENT_SIZE;
+
+  while (size > MIN_ELEMENT_SIZE &&
+         (long long)(p + 2) * prime * size > MAX_IO_BUFFER_SIZE_SUM)
+    size >>= 1;
+  return size;
+}
+
+/**
+ * @brief 取得要加密的文件 file_name 的字节数。
+ * 文件不存在或不是普通文件时报告 "File does not exist!"。
+ * @return 是否成功
+ */
+bool get_input_size(const char *file_name, long long *size) {
+  struct stat file_stat;
+
+  if (stat(file_name, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+    report("File does not exist!\n");
+    return false;
+  }
+  *size = file_stat.st_size;
+  return true;
+}
+
+/**
+ * @brief 检查编码方式 code 下质数 prime 是否可用，不可用时报告原因。
+ * prime 必须是质数，否则最多两列损坏时也可能无法正确恢复；每个文件至少有
+ * MIN_DISK_NUM 列：EVENODD 要求 p >= 3，RDP 要求 p >= 5；数据列数不超过
+ * MAX_P。须在按列数声明变长数组之前调用。
+ * @return prime 是否可用
+ */
+bool check_prime(const int prime, const int code) {
+  const int p = code == CODE_RDP ? prime - 1 : prime; // 数据列数
+
+  if (!is_prime(prime)) {
+    report("p should be a prime number!\n");
+    return false;
+  }
+  if (p + 2 < MIN_DISK_NUM) {
+    if (code == CODE_RDP)
+      report("RDP needs p >= %d!\n", MIN_DISK_NUM);
+    else
+      report("EVENODD needs p >= %d!\n", MIN_DISK_NUM - 2);
+    return false;
+  }
+  if (p > MAX_P) {
+    report("Too many data columns (at most %d)!\n", MAX_P);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 读入文件 file_name，经 EVENODD 加密后储存。
+ * 从文件 file_name 读入数据并编码，然后将 p + 2 个数据块储存在
+ * "disk_0", "disk_1", ..., "disk_{p + 1}" 文件夹下。
+ * 每个元素的字节数由 options.element_size 决定，options.threads > 1 时
+ * 使用多线程流水线加密，元素较大时数据列零拷贝写出（见 use_zero_copy）。
+ * 写完后在各磁盘的清单末尾追加该文件的记录。
+ * options.code 为 CODE_RDP 时使用 RDP 编码，数据列数为 prime - 1。
+ * @param file_name 文件名，长度不超过 100
+ * @param prime 编码使用的质数，应当为不超过 100 的整数
+ * @return 是否成功
+ * @example write_file("testfile", 5);
+ */
+bool write_file(const char *file_name, const int prime) {
+  if (!check_prime(prime, options.code))
+    return false;
+
+  const int p = options.code == CODE_RDP ? prime - 1 : prime; // 数据列数
+  struct Input input;
+  struct Output output[p + 2];
+  struct File_info info;
+  const int w = options.element_size >> 3;
+  const int n = (prime - 1) * w; // 每个条带中每列的 uint64 个数
+
+  if (options.element_size > max_element_size(p, prime)) {
+    report("Element size too large (at most %d bytes for p = %d)!\n",
+           max_element_size(p, prime), prime);
+    return false;
+  }
+  if (strcmp(file_name, MANIFEST_NAME) == 0) {
+    report("Invalid file name!\n");
+    return false;
+  }
+
+  if (!get_input_size(file_name, &info.file_size))
+    return false;
+  info.p = p;
+  info.w = w;
+  info.crc = options.crc;
+  info.code = options.code;
+
+  // 单线程且不使用零拷贝时由 libevenodd 的编码器写出文件头和 CRC32C 文件尾
+  const bool stream = options.threads == 1 && !use_zero_copy(&info);
+
+  if (!init_input(&input, info.file_size, p * n, file_name)) {
+    report("File does not exist!\n");
+    return false;
+  }
+
+  for (int i = 0; i < p + 2; i++) {
+    char disk_file_name[MAX_FILE_NAME_LENGTH];
+
+    sprintf(disk_file_name, "disk_%d/%s", i, file_name);
+    init_output(&output[i],
+                min64(MAX_IO_BUFFER_SIZE_SUM / (p + 2), info.file_size / p), n,
+                disk_file_name);
+
+    // 先将文件头输出
+    if (!stream) {
+      write_uint64_direct(&output[i], make_header(&info));
+      if (info.crc)
+        enable_output_crc(&output[i], crc_block_stripes(&info) * n * 8);
+    }
+  }
+
+  bool ok = true;
+  if (stream)
+    encode_stream(&input, output, &info);
+  else if (options.threads > 1)
+    encode_pipeline(&input, output, &info);
+  else
+    ok = encode_zero_copy(&input, output, &info);
+  add_stat(&stats->stripes, get_stripe_num(&info));
+
+  del_input(&input);
+  for (int i = 0; i < p + 2; i++)
+    ok &= del_output(&output[i]);
+  if (!ok) { // 写出失败时删除各列，不留下不完整的文件
+    report("Write failed!\n");
+    for (int i = 0; i < p + 2; i++) {
+      char disk_file_name[MAX_FILE_NAME_LENGTH];
+
+      sprintf(disk_file_name, "disk_%d/%s", i, file_name);
+      unlink(disk_file_name);
+    }
+    return false;
+  }
+  for (int i = 0; i < p + 2; i++)
+    append_manifest(i, file_name, &info, false);
+  unpack_file(file_name);
+  return true;
+}
+
+/**
+ * @brief 找到文件 file_name 的任意一个列文件并读出文件头。
+ * 前 3 列都不存在时文件已无法读出，先查清单；清单中没有时（清单只是
+ * 提示，可能缺少记录）再逐个尝试其余的磁盘。
+ * @return 文件是否存在
+ */
+bool find_file_info(const char *file_name, struct File_info *info) {
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+
+  for (int i = 0; i < MAX_P + 2; i++) {
+    if (i == 3 && lookup_manifest(file_name, info))
+      return true;
+    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+    if (access(disk_file_path, 0) == 0) {
+      get_info(disk_file_path, info);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool read_range(const char *file_name, const char *save_as, long long offset,
+                long long length);
+
+/**
+ * @brief 读出文件 file_name，保存为 save_as。
+ * 数据列完好时顺序读出各数据列；有数据列损坏时改用 read_range 逐批在内存中
+ * 解码，不修改磁盘上的文件。options.write_back 为 true 时，读完后再修复
+ * 损坏的列。
+ * @param file_name 文件名
+ * @param save_as 保存的文件名
+ * @return 是否成功
+ * @example read_file("testfile", "tmp_file");
+ */
+bool read_file(const char *file_name, const char *save_as) {
+  long long file_size;
+  int p, n;
+  struct File_info info;
+  struct Output output;
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+
+  if (options.offset != 0 || options.length >= 0)
+    return read_range(file_name, save_as, options.offset, options.length);
+
+  if (!find_file_info(file_name, &info)) // 可能是打包的文件
+    return read_range(file_name, save_as, 0, -1);
+  file_size = info.file_size;
+  p = info.p;
+  n = (get_prime(&info) - 1) * info.w;
+
+  // 有数据列损坏时逐批在内存中解码后直接写入 save_as，不先修复磁盘上的文件；
+  // 有 CRC32C 文件尾时同样由 read_range 边读边校验
+  bool degraded = info.crc;
+  for (int i = 0; i < p; i++) {
+    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+    degraded |= access(disk_file_path, 0) == -1;
+  }
+  if (degraded) {
+    if (!read_range(file_name, save_as, 0, -1))
+      return false;
+    return !options.write_back || repair_work(file_name, &info, false);
+  }
+
+  struct Input input[p];
+
+  for (int i = 0; i < p; i++) {
+    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+    init_input(&input[i], MAX_IO_BUFFER_SIZE_SUM / p, n, disk_file_path);
+    read_uint64_direct(&input[i]);
+    flush_input(&input[i]);
+  }
+  init_output(&output, file_size, n, save_as);
+
+  int i = 0;
+  while (file_size >= 8LL * n) {
+    if (input[0].ed == input[0].p)
+      for (i = 0; i < p; i++)
+        flush_input(&input[i]);
+    for (i = 0; i < p && file_size >= 8LL * n; i++) {
+      if (output.ed == output.p)
+        flush_output(&output);
+      write_array_unsafe(&output, input[i].p, n);
+      input[i].p += n;
+      file_size -= 8LL * n;
+    }
+  }
+  i = i % p;
+  if (output.ed == output.p)
+    flush_output(&output);
+  if (input[i].ed == input[i].p)
+    flush_input(&input[i]);
+  write_array_unsafe(&output, input[i].p, file_size >> 3);
+  input[i].p += file_size >> 3;
+  flush_output(&output);
+  write_bytes_direct(&output, read_uint64_unsafe(&input[i]), file_size & 7);
+
+  for (int i = 0; i < p; i++)
+    del_input(&input[i]);
+  if (!del_output(&output)) {
+    report("Write failed!\n");
+    return false;
+  }
+  add_stat(&stats->stripes, get_stripe_num(&info));
+  // 修复损坏的校验列
+  return !options.write_back || repair_work(file_name, &info, false);
+}
+
+const int RANGE_CHUNK_BYTES =
+    1 << 22; // 按区间读取时每次处理的原文件字节数（不严格）
+
+/**
+ * @brief 读出原文件 [offset, offset + length) 区间的数据，保存为 save_as。
+ * 由 p 和条带的几何结构算出区间覆盖的条带和列，只读入这些列中被覆盖的部分。
+ * 某批条带用到的数据列损坏时，读入这些条带的完好列并只在内存中解码，
+ * 不写回磁盘。有 CRC32C 文件尾时按块读入并校验，校验失败的块视为损坏。
+ * @param file_name 文件名
+ * @param save_as 保存的文件名
+ * @param offset 起始字节
+ * @param length 字节数，为负数时读到文件末尾
+ * @return 是否成功
+ * @example read_range("testfile", "part", 1 << 20, 4096);
+ */
+bool read_range(const char *file_name, const char *save_as, long long offset,
+                long long length) {
+  struct File_info info;
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+
+  if (!find_file_info(file_name, &info)) {
+    struct Pack_entry entry;
+    if (lookup_pack(file_name, &entry)) { // 打包的文件：读出容器中的一段
+      offset = min64(offset, entry.length);
+      length = length < 0 ? entry.length - offset
+                          : min64(length, entry.length - offset);
+      return read_range(entry.container, save_as, entry.offset + offset,
+                        length);
+    }
+    report("File does not exist!\n");
+    return false;
+  }
+
+  const int p = info.p, q = get_prime(&info), w = info.w;
+  const int n = (q - 1) * w; // 每个条带中每列的 uint64 个数
+  const struct Codec codec = get_codec(&info);
+  const long long column_bytes = 8LL * n, stripe_bytes = column_bytes * p;
+  const long long stripe_words = (long long)(p + 2) * q * w; // 解码用的条带缓存
+  // 有 CRC32C 文件尾时按整块读取和校验，每批为整数个块
+  const long long block = info.crc ? crc_block_stripes(&info) : 1;
+  const long long chunk =
+      (max64(1, RANGE_CHUNK_BYTES / stripe_bytes) + block - 1) / block * block;
+  bool check_disk[p + 2];
+  int fd[p + 2], idx[2], number_erasures = 0;
+
+  for (int i = 0; i < p + 2; i++) {
+    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+    fd[i] = open(disk_file_path, O_RDONLY);
+    track_fd(fd[i], disk_file_path);
+    check_disk[i] = fd[i] >= 0;
+    if (!check_disk[i] && number_erasures++ < 2)
+      idx[number_erasures - 1] = i;
+  }
+  if (number_erasures > 2) {
+    report("File corrupted!\n");
+    for (int i = 0; i < p + 2; i++)
+      if (check_disk[i])
+        close(fd[i]);
+    return false;
+  }
+  // 只需要求出数据列：对角线校验列损坏时可以不管，只用行校验修复
+  if (number_erasures == 2 && idx[1] == p + 1)
+    number_erasures = 1;
+
+  offset = min64(max64(offset, 0), info.file_size);
+  const long long end = length < 0 ? info.file_size
+                                   : min64(info.file_size, offset + length);
+  // 读到的最后一个条带（向上取整到块）之后
+  const long long stripe_end =
+      min64(get_stripe_num(&info),
+            ((end + stripe_bytes - 1) / stripe_bytes + block - 1) / block *
+                block);
+  // 各列本批的数据，第 i 列位于 seg + i * chunk * column_bytes
+  char *seg = (char *)malloc((p + 2) * chunk * column_bytes);
+  char *out = (char *)malloc(chunk * stripe_bytes); // 本批的原文件数据
+  bool *bad = (bool *)malloc((p + 2) * (chunk / block)); // 各列损坏的块
+  uint64 *a = NULL, *col[p + 2];
+  bool corrupted = false, failed = false;
+  FILE *save;
+
+  file_create(save_as);
+  save = fopen(save_as, "wb");
+  track_fd(fileno(save), save_as);
+  for (long long t0 = offset / stripe_bytes / block * block;
+       t0 * stripe_bytes < end && !corrupted && !failed; t0 += chunk) {
+    const long long t1 = min64(t0 + chunk, stripe_end);
+    const int k = t1 - t0;
+    // 本批在原文件中读取的字节区间 [lo, hi)
+    const long long lo = max64(offset, t0 * stripe_bytes);
+    const long long hi = min64(end, t1 * stripe_bytes);
+    long long first[p], last[p]; // 各数据列被覆盖的字节区间，相对本批开头
+    bool degraded = false;
+
+    for (int i = 0; i < p; i++) {
+      first[i] = last[i] = -1;
+      for (long long t = t0; t < t1; t++) {
+        const long long base = t * stripe_bytes + i * column_bytes;
+        const long long st = max64(lo, base);
+        const long long ed = min64(hi, base + column_bytes);
+        if (st >= ed)
+          continue;
+        if (first[i] < 0)
+          first[i] = (t - t0) * column_bytes + st - base;
+        last[i] = (t - t0) * column_bytes + ed - base;
+      }
+      degraded |= first[i] >= 0 && !check_disk[i];
+    }
+
+    // 数据列都在时只读被覆盖的部分（有 CRC 时读整块并校验）
+    for (int i = 0; i < p && !degraded; i++) {
+      char *data = seg + i * chunk * column_bytes;
+      if (first[i] < 0)
+        continue;
+      if (info.crc) {
+        pread_full(fd[i], data, k * column_bytes, 8 + t0 * column_bytes);
+        degraded = !verify_crc_blocks(fd[i], &info, data, t0, t1, bad);
+      } else
+        pread_full(fd[i], data + first[i], last[i] - first[i],
+                   8 + t0 * column_bytes + first[i]);
+    }
+
+    if (degraded) { // 读入本批条带的完好列，在内存中逐条带解码
+      if (a == NULL)
+        a = (uint64 *)malloc((chunk * stripe_words + (2 * q + 1) * w) << 3);
+      for (int i = 0; i < p + 2; i++) {
+        // 没有 CRC 且只损坏一个数据列时用不到对角线校验列
+        const bool needed =
+            check_disk[i] && (i <= p || number_erasures == 2 || info.crc);
+        char *data = seg + i * chunk * column_bytes;
+        bool *bad_i = bad + i * (chunk / block);
+
+        memset(bad_i, !needed, chunk / block);
+        if (needed) {
+          pread_full(fd[i], data, k * column_bytes, 8 + t0 * column_bytes);
+          if (info.crc)
+            verify_crc_blocks(fd[i], &info, data, t0, t1, bad_i);
+        }
+        for (int s = 0; s < k; s++) {
+          uint64 *dst = a + s * stripe_words + (long long)i * q * w;
+          if (needed)
+            memcpy(dst, data + s * column_bytes, column_bytes);
+          else
+            memset(dst, 0, column_bytes);
+          memset(dst + n, 0, (long long)w << 3);
+        }
+      }
+      for (int s = 0; s < k && !corrupted; s++) {
+        int bad_idx[p + 2], bad_num = 0;
+
+        for (int i = 0; i < p + 2; i++) {
+          col[i] = a + s * stripe_words + (long long)i * q * w;
+          if (bad[i * (chunk / block) + s / block]) {
+            bad_idx[bad_num++] = i;
+            memset(col[i], 0, column_bytes);
+          }
+        }
+        if (bad_num == 2 && bad_idx[1] == p + 1)
+          bad_num = 1;
+        if (bad_num > 2)
+          corrupted = true;
+        else if (bad_num > 0)
+          codec.decode(col, get_decode_plan(&info, bad_idx, bad_num),
+                       a + chunk * stripe_words, p, w);
+      }
+    }
+
+    for (int i = 0; i < p; i++) {
+      if (first[i] < 0)
+        continue;
+      for (long long t = t0; t < t1; t++) {
+        const long long base = t * stripe_bytes + i * column_bytes;
+        const long long st = max64(lo, base);
+        const long long ed = min64(hi, base + column_bytes);
+        if (st >= ed)
+          continue;
+        const char *src =
+            degraded
+                ? (char *)(a + (t - t0) * stripe_words + (long long)i * q * w)
+                : seg + i * chunk * column_bytes + (t - t0) * column_bytes;
+        memcpy(out + st - lo, src + st - base, ed - st);
+      }
+    }
+    failed = !fwrite_counted(out, hi - lo, save);
+    add_stat(&stats->stripes, k);
+  }
+
+  failed |= fclose(save) != 0;
+  for (int i = 0; i < p + 2; i++)
+    if (check_disk[i])
+      close(fd[i]);
+  free(seg);
+  free(out);
+  free(bad);
+  free(a);
+  if (corrupted)
+    report("File corrupted!\n");
+  else if (failed)
+    report("Write failed!\n");
+  return !corrupted && !failed;
+}
+
+const int UPDATE_CHUNK_BYTES =
+    1 << 22; // update 每次处理的原文件字节数（不严格）
+
+/**
+ * @brief 把原文件从 offset 开始的若干字节替换为文件 data_file 的内容。
+ * 只读写被修改的条带：对每个数据列求出新旧数据之差（old ^ new），写回新数据，
+ * 再把差累加到行校验和对角线校验的对应元素上。落在第 p - 1 条对角线上的
+ * 元素会改变调整因子 S，其差要累加到该条带所有的对角线校验元素上。
+ * RDP 没有调整因子，但行校验列也在对角线上：差还要累加到行校验元素所在
+ * 对角线的校验元素上。
+ * 修改不能超出原文件的范围；有损坏的列时先修复。
+ * @param file_name 文件名
+ * @param offset 修改的起始字节
+ * @param data_file 新数据所在的文件
+ * @return 是否成功
+ * @example update_file("testfile", 4096, "patch");
+ */
+bool update_file(const char *file_name, const long long offset,
+                 const char *data_file) {
+  struct File_info info;
+  struct Pack_entry entry;
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+
+  const bool found = find_file_info(file_name, &info);
+  if (!found && lookup_pack(file_name, &entry)) {
+    report("Packed files cannot be updated!\n");
+    return false;
+  }
+  if (!found || access(data_file, 0) == -1) {
+    report("File does not exist!\n");
+    return false;
+  }
+
+  const long long len = get_file_stat(data_file).st_size;
+  if (offset < 0 || offset + len > info.file_size) {
+    report("Update out of range!\n");
+    return false;
+  }
+  if (!repair_work(file_name, &info, false)) {
+    report("File corrupted!\n");
+    return false;
+  }
+
+  const int p = info.p, q = get_prime(&info), w = info.w;
+  const int n = (q - 1) * w; // 每个条带中每列的 uint64 个数
+  const long long column_bytes = 8LL * n, stripe_bytes = column_bytes * p;
+  const long long chunk = max64(1, UPDATE_CHUNK_BYTES / stripe_bytes);
+  int fd[p + 2], data_fd = open(data_file, O_RDONLY);
+  char *fresh = (char *)malloc(chunk * stripe_bytes); // 本批的新数据
+  // 一个数据列的旧数据 / 新数据（之后为差），两个校验列的差，各条带 S 的差
+  uint64 *old = (uint64 *)malloc(chunk * column_bytes);
+  uint64 *cur = (uint64 *)malloc(chunk * column_bytes);
+  uint64 *delta[2] = {(uint64 *)malloc(chunk * column_bytes),
+                      (uint64 *)malloc(chunk * column_bytes)};
+  uint64 *adjuster = (uint64 *)malloc(chunk * w * 8);
+  bool adjusted[chunk];
+  bool touched[p + 2]; // 各列是否被改写，用于更新 CRC32C 文件尾
+  bool ok = data_fd >= 0;
+
+  track_fd(data_fd, data_file);
+  for (int i = 0; i < p + 2; i++) {
+    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+    fd[i] = open(disk_file_path, O_RDWR);
+    track_fd(fd[i], disk_file_path);
+    touched[i] = false;
+    ok &= fd[i] >= 0;
+  }
+  const bool opened = ok;
+  if (!opened)
+    report("File does not exist!\n");
+
+  for (long long t0 = offset / stripe_bytes;
+       ok && t0 * stripe_bytes < offset + len; t0 += chunk) {
+    const long long t1 =
+        min64(t0 + chunk, (offset + len + stripe_bytes - 1) / stripe_bytes);
+    // 本批在原文件中修改的字节区间 [lo, hi)
+    const long long lo = max64(offset, t0 * stripe_bytes);
+    const long long hi = min64(offset + len, t1 * stripe_bytes);
+    // 校验列中需要读写的字区间 [parity_lo[c], parity_hi[c])，相对本批开头
+    long long parity_lo[2] = {chunk * n, chunk * n}, parity_hi[2] = {0, 0};
+
+    pread_full(data_fd, fresh, hi - lo, lo - offset);
+    memset(delta[0], 0, (t1 - t0) * column_bytes);
+    memset(delta[1], 0, (t1 - t0) * column_bytes);
+    memset(adjusted, 0, sizeof(adjusted));
+
+    for (int i = 0; i < p; i++) {
+      long long first = -1, last = -1; // 本列被修改的字节区间，相对本批开头
+
+      for (long long t = t0; t < t1; t++) {
+        const long long base = t * stripe_bytes + i * column_bytes;
+        const long long st = max64(lo, base);
+        const long long ed = min64(hi, base + column_bytes);
+        if (st >= ed)
+          continue;
+        if (first < 0)
+          first = (t - t0) * column_bytes + st - base;
+        last = (t - t0) * column_bytes + ed - base;
+      }
+      if (first < 0)
+        continue;
+      touched[i] = true;
+
+      // 按字读写，并把差扩展到完整的元素
+      const long long wf = first >> 3, wl = (last + 7) >> 3;
+      const long long ef = wf / w * w, el = (wl + w - 1) / w * w;
+      memset(cur + ef, 0, (el - ef) << 3);
+      pread_full(fd[i], old + wf, (wl - wf) << 3,
+                 8 + t0 * column_bytes + wf * 8);
+      memcpy(cur + wf, old + wf, (wl - wf) << 3);
+      for (long long t = t0; t < t1; t++) {
+        const long long base = t * stripe_bytes + i * column_bytes;
+        const long long st = max64(lo, base);
+        const long long ed = min64(hi, base + column_bytes);
+        if (st < ed)
+          memcpy((char *)cur + (t - t0) * column_bytes + st - base,
+                 fresh + st - lo, ed - st);
+      }
+      ok &= pwrite_full(fd[i], cur + wf, (wl - wf) << 3,
+                        8 + t0 * column_bytes + wf * 8);
+      evenodd_xor_into(cur + wf, old + wf, wl - wf);
+
+      for (long long k = ef; k < el; k += w) {
+        const long long s = k / n;
+        const int j = k % n / w, l = (i + j) % q;
+
+        evenodd_xor_into(delta[0] + k, cur + k, w);
+        if (info.code == CODE_RDP) {
+          // 该元素在第 l 条对角线上，行校验元素在第 j - 1 条上；
+          // 第 q - 1 条对角线不存储
+          const int diag[2] = {l, (j + q - 1) % q};
+          for (int e = 0; e < 2; e++) {
+            if (diag[e] == q - 1)
+              continue;
+            evenodd_xor_into(delta[1] + s * n + (long long)diag[e] * w,
+                             cur + k, w);
+            parity_lo[1] = min64(parity_lo[1], s * n + (long long)diag[e] * w);
+            parity_hi[1] =
+                max64(parity_hi[1], s * n + (long long)(diag[e] + 1) * w);
+          }
+        } else if (l == p - 1) { // 调整因子 S 改变
+          if (adjusted[s])
+            evenodd_xor_into(adjuster + s * w, cur + k, w);
+          else
+            memcpy(adjuster + s * w, cur + k, (long long)w << 3);
+          adjusted[s] = true;
+        } else {
+          evenodd_xor_into(delta[1] + s * n + (long long)l * w, cur + k, w);
+          parity_lo[1] = min64(parity_lo[1], s * n + (long long)l * w);
+          parity_hi[1] = max64(parity_hi[1], s * n + (long long)(l + 1) * w);
+        }
+      }
+      parity_lo[0] = min64(parity_lo[0], ef);
+      parity_hi[0] = max64(parity_hi[0], el);
+    }
+
+    for (long long s = 0; s < t1 - t0; s++)
+      if (adjusted[s]) {
+        for (int l = 0; l < p - 1; l++)
+          evenodd_xor_into(delta[1] + s * n + (long long)l * w,
+                           adjuster + s * w, w);
+        parity_lo[1] = min64(parity_lo[1], s * n);
+        parity_hi[1] = max64(parity_hi[1], (s + 1) * n);
+      }
+
+    for (int c = 0; c < 2; c++) { // 写回两个校验列
+      const long long wf = parity_lo[c], wl = parity_hi[c];
+      if (wf >= wl)
+        continue;
+      touched[p + c] = true;
+      pread_full(fd[p + c], old + wf, (wl - wf) << 3,
+                 8 + t0 * column_bytes + wf * 8);
+      evenodd_xor_into(old + wf, delta[c] + wf, wl - wf);
+      ok &= pwrite_full(fd[p + c], old + wf, (wl - wf) << 3,
+                        8 + t0 * column_bytes + wf * 8);
+    }
+    add_stat(&stats->stripes, t1 - t0);
+  }
+
+  if (ok && info.crc) { // 重新计算被修改的块的 CRC32C
+    const long long block = crc_block_stripes(&info);
+    const long long first = offset / stripe_bytes / block;
+    const long long last =
+        ((offset + len + stripe_bytes - 1) / stripe_bytes + block - 1) / block;
+    for (int i = 0; i < p + 2; i++)
+      if (touched[i])
+        ok &= write_crc_blocks(fd[i], &info, first, last);
+  }
+  if (opened && !ok)
+    report("Write failed!\n");
+
+  for (int i = 0; i < p + 2; i++)
+    if (fd[i] >= 0)
+      close(fd[i]);
+  if (data_fd >= 0)
+    close(data_fd);
+  free(fresh);
+  free(old);
+  free(cur);
+  free(delta[0]);
+  free(delta[1]);
+  free(adjuster);
+  return ok;
+}
+
+/**
+ * @brief 以打包模式储存文件 file_name：追加到质数 p 的容器末尾。
+ * 容器末尾不足一个条带时，先读回最后一个条带的数据，与新数据一起重新
+ * 编码；之后的条带直接编码，各列用一次 pwritev 顺序写出。写完后更新
+ * 容器的文件头，并在各磁盘的清单和索引中追加记录。当前容器将超过
+ * PACK_CONTAINER_BYTES 时换用新容器；大于 PACK_MAX_OBJECT_BYTES 的文件
+ * 按普通方式储存。容器总是使用 EVENODD 编码，不受 options.code 影响；
+ * options.crc 为 true 时放入另一组带 CRC32C 文件尾的容器，追加后保留
+ * 未改动的块的 CRC32C，只重新计算从容器原末尾所在块开始的各块。
+ * 写出失败时不记入索引，并把容器恢复为追加之前的内容（新建的容器直接删除）。
+ * @param file_name 文件名
+ * @param p 用于 EVENODD 加密的质数
+ * @return 是否成功
+ * @example pack_file("small", 97);
+ */
+bool pack_file(const char *file_name, const int p) {
+  long long len;
+  const int w = options.element_size >> 3;
+  const int n = (p - 1) * w; // 每个条带中每列的 uint64 个数
+  const long long column_bytes = 8LL * n, stripe_bytes = column_bytes * p;
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+  struct File_info info;
+  struct Pack_entry entry;
+
+  if (!get_input_size(file_name, &len))
+    return false;
+  if (len > PACK_MAX_OBJECT_BYTES)
+    return write_file(file_name, p);
+  if (!check_prime(p, CODE_EVENODD))
+    return false;
+  if (options.element_size > max_element_size(p, p)) {
+    report("Element size too large (at most %d bytes for p = %d)!\n",
+           max_element_size(p, p), p);
+    return false;
+  }
+  int data_fd = open(file_name, O_RDONLY);
+  if (data_fd < 0) {
+    report("File does not exist!\n");
+    return false;
+  }
+  track_fd(data_fd, file_name);
+
+  // 同一时间只能有一个进程追加容器
+  sprintf(disk_file_path, "disk_0/%s/lock", PACK_INDEX_DIR);
+  if (access(disk_file_path, 0) == -1)
+    file_create(disk_file_path);
+  int lock_fd = open(disk_file_path, O_RDONLY);
+  flock(lock_fd, LOCK_EX);
+
+  for (int id = 0;; id++) {
+    sprintf(entry.container, "%s/p%d_e%d%s_%d", PACK_DIR, p, w * 8,
+            options.crc ? "_crc" : "", id);
+    if (!find_file_info(entry.container, &info)) { // 新建容器
+      info.file_size = 0;
+      info.p = p;
+      info.w = w;
+      info.crc = options.crc;
+      info.code = CODE_EVENODD;
+      break;
+    }
+    if (info.file_size + len <= PACK_CONTAINER_BYTES)
+      break;
+  }
+  if (info.file_size > 0 && !repair_work(entry.container, &info, false)) {
+    report("File corrupted!\n");
+    close(data_fd);
+    close(lock_fd);
+    return false;
+  }
+
+  const long long chunk =
+      max64(1, min64(MAX_IOV_NUM, UPDATE_CHUNK_BYTES / stripe_bytes));
+  const long long old_size = info.file_size;
+  const struct Codec codec = get_codec(&info);
+  uint64 *a = (uint64 *)malloc(chunk * (p + 2) * column_bytes);
+  uint64 *col[p + 2];
+  struct iovec iov[chunk];
+  int fd[p + 2];
+  // 有 CRC32C 时，容器原末尾所在块之前的各块不变，先读出它们的 CRC32C
+  const long long block = crc_block_stripes(&info);
+  const long long kept_blocks = info.crc ? old_size / stripe_bytes / block : 0;
+  const long long old_trailer = 8 + get_stripe_num(&info) * column_bytes;
+  unsigned *kept_crc = (unsigned *)malloc((p + 2) * kept_blocks * 4 + 4);
+  // 容器末尾不完整的条带会被重新编码，先保存各列原来的内容，写出失败时恢复
+  const long long tail_stripe = old_size / stripe_bytes;
+  const bool has_tail = old_size % stripe_bytes != 0;
+  uint64 *tail = (uint64 *)malloc((p + 2) * column_bytes);
+  bool ok = true;
+
+  entry.p = p;
+  entry.offset = old_size;
+  entry.length = len;
+  info.file_size += len;
+  for (int i = 0; i < p + 2; i++) {
+    sprintf(disk_file_path, "disk_%d/%s", i, entry.container);
+    if (old_size == 0)
+      file_create(disk_file_path);
+    fd[i] = open(disk_file_path, O_RDWR);
+    track_fd(fd[i], disk_file_path);
+    ok &= fd[i] >= 0;
+    pread_full(fd[i], kept_crc + i * kept_blocks, kept_blocks * 4,
+               old_trailer);
+    if (has_tail)
+      pread_full(fd[i], tail + (long long)i * n, column_bytes,
+                 8 + tail_stripe * column_bytes);
+  }
+
+  for (long long t0 = old_size / stripe_bytes;
+       ok && t0 * stripe_bytes < info.file_size; t0 += chunk) {
+    const int k = min64(chunk, (info.file_size + stripe_bytes - 1) /
+                                   stripe_bytes -
+                               t0);
+    // 本批在容器原文件中新写入的字节区间 [lo, hi)
+    const long long lo = max64(old_size, t0 * stripe_bytes);
+    const long long hi = min64(info.file_size, (t0 + k) * stripe_bytes);
+
+    memset(a, 0, k * (p + 2) * column_bytes);
+    if (lo > t0 * stripe_bytes) // 读回容器末尾不完整的条带
+      for (int i = 0; i < p; i++)
+        pread_full(fd[i], a + (long long)i * n, column_bytes,
+                   8 + t0 * column_bytes);
+    // 每个条带的数据列在 a 中连续存放，与原文件的顺序相同
+    for (int s = 0; s < k; s++) {
+      const long long base = (t0 + s) * stripe_bytes;
+      const long long st = max64(lo, base);
+      const long long ed = min64(hi, base + stripe_bytes);
+      pread_full(data_fd, (char *)(a + s * (p + 2) * n) + st - base, ed - st,
+                 st - old_size);
+      for (int i = 0; i < p + 2; i++)
+        col[i] = a + (s * (p + 2) + i) * n;
+      codec.encode(col, p, w);
+    }
+    for (int i = 0; i < p + 2; i++) {
+      for (int s = 0; s < k; s++) {
+        iov[s].iov_base = a + (s * (p + 2) + i) * n;
+        iov[s].iov_len = column_bytes;
+      }
+      ok &= pwrite_iov(fd[i], iov, k, 8 + t0 * column_bytes) ==
+            k * column_bytes;
+    }
+    add_stat(&stats->stripes, k);
+  }
+
+  const uint64 header = make_header(&info);
+  for (int i = 0; i < p + 2 && ok && info.crc; i++) // 文件尾随条带数后移
+    ok = pwrite_full(fd[i], kept_crc + i * kept_blocks, kept_blocks * 4,
+                     8 + get_stripe_num(&info) * column_bytes) &&
+         write_crc_blocks(fd[i], &info, kept_blocks,
+                          (get_stripe_num(&info) + block - 1) / block);
+  // 最后写文件头：之前写出失败时容器的大小不变，也不记入索引
+  for (int i = 0; i < p + 2 && ok; i++)
+    ok = pwrite_full(fd[i], &header, 8, 0);
+  if (!ok) { // 删除新建的容器，或尽量把容器恢复为追加之前的内容
+    info.file_size = old_size;
+    const uint64 old_header = make_header(&info);
+    for (int i = 0; i < p + 2; i++) {
+      sprintf(disk_file_path, "disk_%d/%s", i, entry.container);
+      if (old_size == 0) {
+        unlink(disk_file_path);
+        continue;
+      }
+      if (fd[i] < 0 || ftruncate(fd[i], old_trailer) != 0)
+        continue;
+      if (has_tail)
+        pwrite_full(fd[i], tail + (long long)i * n, column_bytes,
+                    8 + tail_stripe * column_bytes);
+      if (info.crc) {
+        pwrite_full(fd[i], kept_crc + i * kept_blocks, kept_blocks * 4,
+                    old_trailer);
+        write_crc_blocks(fd[i], &info, kept_blocks,
+                         (get_stripe_num(&info) + block - 1) / block);
+      }
+      pwrite_full(fd[i], &old_header, 8, 0);
+    }
+  }
+  for (int i = 0; i < p + 2; i++) {
+    if (fd[i] >= 0)
+      close(fd[i]);
+    if (ok) {
+      append_manifest(i, entry.container, &info, false);
+      append_pack_index(i, file_name, &entry);
+    }
+  }
+  if (!ok)
+    report("Write failed!\n");
+  // 同名文件原来以普通方式储存时删除其各列，并在清单中记下删除
+  else if (find_file_info(file_name, &info))
+    for (int i = 0; i < info.p + 2; i++) {
+      sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+      unlink(disk_file_path);
+      append_manifest(i, file_name, &info, true);
+    }
+  close(data_fd);
+  close(lock_fd);
+  free(a);
+  free(kept_crc);
+  free(tail);
+  return ok;
+}
+
+/**
+ * @brief 遍历任务：一个文件夹（遍历其子项）或一个文件（调用 work）。
+ */
+struct Task {
+  char *path; // 由 task_push 申请，处理完后释放
+  bool is_dir;
+};
+
+/**
+ * @brief 每个遍历线程私有的双端任务队列。
+ * 线程自己从尾部存取（深度优先，局部性好），空闲线程从头部窃取。
+ */
+struct Task_deque {
+  pthread_mutex_t lock;
+  struct Task *tasks;
+  int head, tail, capacity; // 有效任务为 tasks[head ... tail - 1]
+};
+
+/**
+ * @brief 字符串列表，用于收集无法修复（或检查出损坏）的文件。
+ */
+struct File_list {
+  pthread_mutex_t lock;
+  char **names;
+  int size, capacity;
+};
+
+void init_file_list(struct File_list *list) {
+  pthread_mutex_init(&list->lock, NULL);
+  list->names = NULL;
+  list->size = list->capacity = 0;
+}
+
+void file_list_add(struct File_list *list, const char *name) {
+  pthread_mutex_lock(&list->lock);
+  if (list->size == list->capacity) {
+    list->capacity = max64(16, list->capacity * 2);
+    list->names =
+        (char **)realloc(list->names, list->capacity * sizeof(char *));
+  }
+  list->names[list->size++] = strdup(name);
+  pthread_mutex_unlock(&list->lock);
+}
+
+void del_file_list(struct File_list *list) {
+  for (int i = 0; i < list->size; i++)
+    free(list->names[i]);
+  free(list->names);
+  pthread_mutex_destroy(&list->lock);
+}
+
+/**
+ * @brief 并行遍历的共享状态。
+ * work 处理一个文件（file_name 为原文件路径），返回 false 时记入 failed。
+ */
+struct Repair_pool {
+  int worker_num;
+  struct Task_deque *deques;
+  atomic_llong pending; // 已入队但尚未处理完的任务数
+  bool (*work)(const char *file_name, const struct File_info *info);
+  struct File_list *failed;     // 处理失败的文件
+  const struct Manifest *skip; // 其中的文件已处理过，遍历时跳过
+};
+
+struct Repair_worker {
+  struct Repair_pool *pool;
+  int id;
+};
+
+void task_push(struct Task_deque *deque, const char *path, bool is_dir) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->tail == deque->capacity) {
+    if (deque->head > 0) { // 前面有空位时先整体前移
+      memmove(deque->tasks, deque->tasks + deque->head,
+              (deque->tail - deque->head) * sizeof(struct Task));
+      deque->tail -= deque->head;
+      deque->head = 0;
+    }
+    if (deque->tail == deque->capacity) {
+      deque->capacity = max64(64, deque->capacity * 2);
+      deque->tasks = (struct Task *)realloc(
+          deque->tasks, deque->capacity * sizeof(struct Task));
+    }
+  }
+  deque->tasks[deque->tail].path = strdup(path);
+  deque->tasks[deque->tail].is_dir = is_dir;
+  deque->tail++;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+/**
+ * @brief 从队列取出一个任务。
+ * @param from_tail 为 true 时从尾部取（自己的队列），否则从头部窃取
+ * @return 是否取到任务
+ */
+bool task_pop(struct Task_deque *deque, struct Task *task, bool from_tail) {
+  bool ok = false;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->head < deque->tail) {
+    *task = from_tail ? deque->tasks[--deque->tail]
+                      : deque->tasks[deque->head++];
+    ok = true;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return ok;
+}
+
+void run_repair_task(struct Repair_pool *pool, struct Task_deque *deque,
+                     const struct Task *task) {
+  char sub_dir_path[MAX_FILE_NAME_LENGTH];
+  struct File_info info;
+
+  if (task->is_dir) {
+    DIR *root;
+    struct dirent *sub_dir;
+
+    root = opendir(task->path);
+    if (root == NULL)
+      return;
+    while ((sub_dir = readdir(root)) != NULL) {
+      if (strcmp(sub_dir->d_name, ".") == 0 ||
+          strcmp(sub_dir->d_name, "..") == 0 ||
+          strcmp(sub_dir->d_name, MANIFEST_NAME) == 0 ||
+          strcmp(sub_dir->d_name, PACK_INDEX_DIR) == 0)
+        continue;
+
+      snprintf(sub_dir_path, MAX_FILE_NAME_LENGTH, "%s/%s", task->path,
+               sub_dir->d_name);
+      atomic_fetch_add(&pool->pending, 1);
+      task_push(deque, sub_dir_path, sub_dir->d_type == DT_DIR);
+    }
+    closedir(root);
+  } else {
+    const char *file_name = strchr(task->path, '/') + 1; // 原文件路径
+
+    if (pool->skip != NULL && find_manifest_entry(pool->skip, file_name))
+      return;
+    get_info(task->path, &info);
+    if (!pool->work(file_name, &info))
+      file_list_add(pool->failed, file_name);
+  }
+}
+
+void *repair_worker(void *arg) {
+  struct Repair_pool *pool = ((struct Repair_worker *)arg)->pool;
+  const int id = ((struct Repair_worker *)arg)->id;
+  struct Task_deque *deque = &pool->deques[id];
+  struct Task task;
+
+  while (atomic_load(&pool->pending) > 0) {
+    bool ok = task_pop(deque, &task, true);
+
+    for (int k = 1; !ok && k < pool->worker_num; k++)
+      ok = task_pop(&pool->deques[(id + k) % pool->worker_num], &task, false);
+    if (!ok) {
+      yield_idle();
+      continue;
+    }
+    run_repair_task(pool, deque, &task);
+    free(task.path);
+    atomic_fetch_sub(&pool->pending, 1);
+  }
+  return NULL;
+}
+
+/**
+ * @brief 对加密数据文件夹中的每个文件调用 work。
+ * 以 options.threads 个线程并行遍历 dir_path：每个线程维护自己的任务队列，
+ * 空闲时从其他线程处窃取任务。work 失败的文件不会中止遍历，
+ * 而是记录到 failed 中，遍历结束后统一返回。
+ * @param dir_path 要遍历的文件夹路径
+ * @param work 处理一个文件的函数
+ * @param failed 用于收集处理失败的文件（原文件路径）
+ * @param skip 为 NULL 或已处理过的清单，跳过其中的文件（不读文件头）
+ * @return 是否全部处理成功
+ * @example walk_directory("disk_1", repair_file, &failed, NULL);
+ */
+bool walk_directory(const char *dir_path,
+                    bool (*work)(const char *, const struct File_info *),
+                    struct File_list *failed, const struct Manifest *skip) {
+  struct Repair_pool pool;
+  const int worker_num = options.threads;
+  pthread_t threads[worker_num];
+  struct Repair_worker args[worker_num];
+  const int failed_before = failed->size;
+
+  pool.worker_num = worker_num;
+  pool.work = work;
+  pool.failed = failed;
+  pool.skip = skip;
+  pool.deques =
+      (struct Task_deque *)malloc(worker_num * sizeof(struct Task_deque));
+  for (int i = 0; i < worker_num; i++) {
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.deques[i].tasks = NULL;
+    pool.deques[i].head = pool.deques[i].tail = pool.deques[i].capacity = 0;
+  }
+  atomic_init(&pool.pending, 1);
+  task_push(&pool.deques[0], dir_path, true);
+
+  for (int i = 0; i < worker_num; i++) {
+    args[i].pool = &pool;
+    args[i].id = i;
+    if (i > 0)
+      create_thread(&threads[i], repair_worker, &args[i]);
+  }
+  repair_worker(&args[0]);
+  for (int i = 1; i < worker_num; i++)
+    join_thread(threads[i]);
+
+  for (int i = 0; i < worker_num; i++) {
+    pthread_mutex_destroy(&pool.deques[i].lock);
+    free(pool.deques[i].tasks);
+  }
+  free(pool.deques);
+  return failed->size == failed_before;
+}
+
+/**
+ * @brief 按清单并行处理文件的共享状态。
+ */
+struct Manifest_walk {
+  const struct Manifest *manifest;
+  atomic_llong next; // 下一个要处理的文件
+  bool (*work)(const char *file_name, const struct File_info *info);
+  struct File_list *failed;
+};
+
+void *manifest_worker(void *arg) {
+  struct Manifest_walk *walk = (struct Manifest_walk *)arg;
+  long long i;
+
+  while ((i = atomic_fetch_add(&walk->next, 1)) < walk->manifest->file_num) {
+    const struct Manifest_entry *entry = walk->manifest->files[i];
+    if (!walk->work(entry->path, &entry->info))
+      file_list_add(walk->failed, entry->path);
+  }
+  return NULL;
+}
+
+/**
+ * @brief 对清单中的每个文件调用 work，不遍历文件夹、不读文件头。
+ * 以 options.threads 个线程并行处理，每个线程每次取下一个文件。
+ * @return 是否全部处理成功
+ * @example walk_manifest(&manifest, repair_file, &failed);
+ */
+bool walk_manifest(const struct Manifest *manifest,
+                   bool (*work)(const char *, const struct File_info *),
+                   struct File_list *failed) {
+  const int worker_num = options.threads;
+  pthread_t threads[worker_num];
+  struct Manifest_walk walk;
+  const int failed_before = failed->size;
+
+  walk.manifest = manifest;
+  walk.work = work;
+  walk.failed = failed;
+  atomic_init(&walk.next, 0);
+  for (int i = 1; i < worker_num; i++)
+    create_thread(&threads[i], manifest_worker, &walk);
+  manifest_worker(&walk);
+  for (int i = 1; i < worker_num; i++)
+    join_thread(threads[i]);
+  return failed->size == failed_before;
+}
+
+/**
+ * @brief 对磁盘文件夹 dir_path 中的每个文件调用 work。
+ * 清单只作为提示：先按清单处理其中的文件（不读文件头），再遍历文件夹，
+ * 处理清单中没有的文件，例如有清单之前写入的文件、追加记录之前中断的写入。
+ * @param manifest 该磁盘的清单，为 NULL 时只遍历文件夹
+ * @return 是否全部处理成功
+ */
+bool walk_disk(const char *dir_path, const struct Manifest *manifest,
+               bool (*work)(const char *, const struct File_info *),
+               struct File_list *failed) {
+  if (manifest == NULL)
+    return walk_directory(dir_path, work, failed, NULL);
+  const bool ok = walk_manifest(manifest, work, failed);
+  return walk_directory(dir_path, work, failed, manifest) && ok;
+}
+
+bool repair_file(const char *file_name, const struct File_info *info) {
+  add_stat(&stats->repair_files, 1);
+  return repair_work(file_name, info, false);
+}
+
+/**
+ * @brief 已知损坏的文件夹个数 number_erasures 以及具体损坏文件夹的编号 idx,
+ * 修复磁盘
+ * @param number_erasures 损坏的文件夹个数，大于 2 时无法修复
+ * @param idx 具体损坏文件夹的编号
+ * @return 是否成功
+ * @example repair(2, [0, 1]);
+ */
+bool repair(const int number_erasures, const int *idx) {
+  if (number_erasures == 0)
+    return true;
+  if (number_erasures > 2) {
+    report("Too many corruptions!\n");
+    return false;
+  }
+
+  int disk_ok_id = 0; // 找到一个完整磁盘，以获取需要修复的文件名
+
+  // 这部分是求 mex
+  while (disk_ok_id == idx[0] || (number_erasures == 2 && disk_ok_id == idx[1]))
+    disk_ok_id++;
+
+  char disk_ok_name[MAX_FILE_NAME_LENGTH];
+  struct File_list failed;
+  struct Manifest manifest;
+
+  sprintf(disk_ok_name, "disk_%d", disk_ok_id);
+  init_file_list(&failed);
+  // 有清单时先按清单修复，并为损坏的磁盘重建清单
+  const bool has_manifest = load_manifest(disk_ok_id, &manifest);
+  const bool ok = walk_disk(disk_ok_name, has_manifest ? &manifest : NULL,
+                            repair_file, &failed);
+  if (has_manifest) {
+    for (int i = 0; i < number_erasures; i++)
+      save_manifest(idx[i], &manifest);
+    del_manifest(&manifest);
+  }
+  for (int i = 0; i < number_erasures; i++)
+    save_pack_index(disk_ok_id, idx[i]);
+  if (!ok) {
+    report("Too many corruptions!\n");
+    for (int i = 0; i < failed.size; i++)
+      report("Unrecoverable: %s\n", failed.names[i]);
+  }
+  del_file_list(&failed);
+  return ok;
+}
+
+const int SCRUB_CHUNK_BYTES = 1 << 22; // scrub 每次读入的字节数（不严格）
+
+/**
+ * @brief scrub 的读取限速器，由所有线程共享。
+ * 按累计读取的字节数和 options.rate 算出应当到达的时刻，提前时睡眠。
+ */
+struct Rate_limiter {
+  pthread_mutex_t lock;
+  struct timespec start; // 开始 scrub 的时刻
+  long long bytes;       // 已读取的字节数
+};
+struct Rate_limiter rate_limiter = {PTHREAD_MUTEX_INITIALIZER, {0, 0}, 0};
+
+/**
+ * @brief scrub 的统计信息。
+ */
+struct Scrub_stats {
+  atomic_llong files, bytes; // 检查的文件数、读取的字节数
+  atomic_llong inconsistent; // 校验列不一致的条带数
+  atomic_llong repaired;     // 已改正的条带数
+};
+struct Scrub_stats scrub_stats;
+// 统计信息和限速器为全局变量，serve 模式下同时只执行一个 scrub
+pthread_mutex_t scrub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void throttle(long long bytes) {
+  struct timespec now;
+
+  if (options.rate <= 0)
+    return;
+  pthread_mutex_lock(&rate_limiter.lock);
+  rate_limiter.bytes += bytes;
+  const double due = (double)rate_limiter.bytes / options.rate;
+  pthread_mutex_unlock(&rate_limiter.lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const double wait = due - (now.tv_sec - rate_limiter.start.tv_sec) -
+                      (now.tv_nsec - rate_limiter.start.tv_nsec) * 1e-9;
+  if (wait > 0) {
+    struct timespec t = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+    const int last = enter_phase(PHASE_IDLE);
+    nanosleep(&t, NULL);
+    enter_phase(last);
+  }
+}
+
+/**
+ * @brief 用数据列重新计算一个条带的两个校验列，并与 col[p]、col[p + 1]
+ * 比较。
+ * @param parity 临时空间，2 * q * w 个 uint64
+ * @param p 数据列数
+ * @param q 编码使用的质数（见 get_prime）
+ * @return 是否一致
+ */
+bool check_stripe(uint64 *const *col, uint64 *parity,
+                  const struct Codec *codec, const int p, const int q,
+                  const int w) {
+  const long long n = (long long)(q - 1) * w;
+  uint64 *tmp[p + 2];
+
+  memcpy(tmp, col, p * sizeof(uint64 *));
+  tmp[p] = parity;
+  tmp[p + 1] = parity + (long long)q * w;
+  codec->encode(tmp, p, w);
+  return memcmp(tmp[p], col[p], n << 3) == 0 &&
+         memcmp(tmp[p + 1], col[p + 1], n << 3) == 0;
+}
+
+/**
+ * @brief 找出不一致的条带中出错的列并改正。
+ * 依次假设每一列出错，把它当作损坏的列解出；解出后一致的即为出错的列。
+ * 各列需要 q * w 个 uint64，末尾 w 个为 0。
+ * @param backup 临时空间，q * w 个 uint64
+ * @param parity 临时空间，2 * q * w 个 uint64
+ * @param work 解码用的临时空间，(2 * q + 1) * w 个 uint64
+ * @param info 文件头信息，q = get_prime(info)
+ * @return 出错列的编号（col 中该列已改正），找不到时返回 -1
+ */
+int locate_error_column(uint64 *const *col, uint64 *backup, uint64 *parity,
+                        uint64 *work, const struct Codec *codec,
+                        const struct File_info *info) {
+  const int p = info->p, q = get_prime(info), w = info->w;
+  const long long n = (long long)(q - 1) * w;
+
+  for (int c = 0; c < p + 2; c++) {
+    memcpy(backup, col[c], n << 3);
+    memset(col[c], 0, (long long)q * w << 3);
+    codec->decode(col, get_decode_plan(info, &c, 1), work, p, w);
+    if (check_stripe(col, parity, codec, p, q, w))
+      return c;
+    memcpy(col[c], backup, n << 3);
+    memset(col[c] + n, 0, (long long)w << 3);
+  }
+  return -1;
+}
+
+/**
+ * @brief 检查文件 file_name 每个条带的校验列是否与数据列一致。
+ * 逐批读入全部 p + 2 列，重新计算两个校验列并与磁盘上的比较，报告不一致
+ * 的条带。options.repair 为 true 时找出出错的列并写回改正后的数据（同时
+ * 更新 CRC32C 文件尾）；有列缺失时调用 repair_work 修复。
+ * @param file_name 原文件路径
+ * @param info 该文件的文件头信息
+ * @return 文件是否完好（或已修复）
+ * @example scrub_file("testfile", &info);
+ */
+bool scrub_file(const char *file_name, const struct File_info *info) {
+  const int p = info->p, q = get_prime(info), w = info->w;
+  const int n = (q - 1) * w; // 每个条带中每列的 uint64 个数
+  const struct Codec codec = get_codec(info);
+  const long long column_bytes = 8LL * n;
+  const long long stripe_words = (long long)(p + 2) * q * w;
+  const long long stripe_num = get_stripe_num(info);
+  const int chunk = max64(1, min64(MAX_IOV_NUM, SCRUB_CHUNK_BYTES /
+                                                (stripe_words << 3)));
+  char disk_file_path[MAX_FILE_NAME_LENGTH];
+  int fd[p + 2], missing = 0;
+  bool ok = true;
+
+  atomic_fetch_add(&scrub_stats.files, 1);
+  for (int i = 0; i < p + 2; i++) {
+    sprintf(disk_file_path, "disk_%d/%s", i, file_name);
+    fd[i] = open(disk_file_path, options.repair ? O_RDWR : O_RDONLY);
+    track_fd(fd[i], disk_file_path);
+    missing += fd[i] < 0;
+  }
+  if (missing > 0) {
+    for (int i = 0; i < p + 2; i++)
+      if (fd[i] >= 0)
+        close(fd[i]);
+    report("Missing columns: %s\n", file_name);
+    return options.repair && repair_work(file_name, info, false);
+  }
+
+  // 各条带的 p + 2 列，之后为两列校验、一列备份和解码用的临时空间
+  uint64 *a = (uint64 *)calloc(chunk * stripe_words + (5LL * q + 1) * w, 8);
+  uint64 *parity = a + chunk * stripe_words;
+  uint64 *backup = parity + 2LL * q * w, *work = backup + (long long)q * w;
+  uint64 *col[p + 2];
+  struct iovec iov[chunk];
+
+  for (long long t = 0; t < stripe_num; t += chunk) {
+    const int k = min64(chunk, stripe_num - t);
+
+    for (int i = 0; i < p + 2; i++) {
+      for (int s = 0; s < k; s++) {
+        iov[s].iov_base = a + s * stripe_words + (long long)i * q * w;
+        iov[s].iov_len = column_bytes;
+      }
+      // 列文件被截断时缺少的部分按 0 处理
+      long long got =
+          max64(0, pread_iov(fd[i], iov, k, 8 + t * column_bytes));
+      for (int s = 0; s < k; s++, got -= column_bytes)
+        if (got < column_bytes)
+          memset((char *)iov[s].iov_base + max64(got, 0), 0,
+                 column_bytes - max64(got, 0));
+    }
+    throttle(k * (p + 2) * column_bytes);
+    atomic_fetch_add(&scrub_stats.bytes, k * (p + 2) * column_bytes);
+    add_stat(&stats->stripes, k);
+
+    for (int s = 0; s < k; s++) {
+      for (int i = 0; i < p + 2; i++) {
+        col[i] = a + s * stripe_words + (long long)i * q * w;
+        memset(col[i] + n, 0, (long long)w << 3);
+      }
+      if (check_stripe(col, parity, &codec, p, q, w))
+        continue;
+
+      const int c =
+          locate_error_column(col, backup, parity, work, &codec, info);
+      atomic_fetch_add(&scrub_stats.inconsistent, 1);
+      if (c < 0) {
+        report("Inconsistent: %s stripe %lld\n", file_name, t + s);
+        ok = false;
+        continue;
+      }
+      report("Inconsistent: %s stripe %lld column %d\n", file_name, t + s, c);
+      if (!options.repair) {
+        ok = false;
+        continue;
+      }
+      const long long b = (t + s) / crc_block_stripes(info);
+      if (!pwrite_full(fd[c], col[c], column_bytes,
+                       8 + (t + s) * column_bytes) ||
+          (info->crc && !write_crc_blocks(fd[c], info, b, b + 1))) {
+        report("Write failed!\n");
+        ok = false;
+        continue;
+      }
+      atomic_fetch_add(&scrub_stats.repaired, 1);
+    }
+  }
+
+  for (int i = 0; i < p + 2; i++)
+    close(fd[i]);
+  free(a);
+  return ok;
+}
+
+/**
+ * @brief 检查 dir_path 下所有文件的校验列是否与数据列一致。
+ * 以 options.threads 个线程并行遍历，总读取速度不超过 options.rate。
+ * @param dir_path 要遍历的文件夹，为 NULL 时使用第一个存在的 disk_i
+ * @return 是否所有文件都一致（或已改正）
+ * @example scrub("disk_0");
+ */
+bool scrub(const char *dir_path) {
+  char disk_name[MAX_FILE_NAME_LENGTH];
+  struct File_list damaged;
+
+  for (int i = 0; dir_path == NULL && i < MAX_P + 2; i++) {
+    sprintf(disk_name, "disk_%d", i);
+    if (access(disk_name, 0) == 0)
+      dir_path = disk_name;
+  }
+  if (dir_path == NULL || access(dir_path, 0) == -1) {
+    report("File does not exist!\n");
+    return false;
+  }
+
+  pthread_mutex_lock(&scrub_lock);
+  atomic_init(&scrub_stats.files, 0);
+  atomic_init(&scrub_stats.bytes, 0);
+  atomic_init(&scrub_stats.inconsistent, 0);
+  atomic_init(&scrub_stats.repaired, 0);
+  clock_gettime(CLOCK_MONOTONIC, &rate_limiter.start);
+  rate_limiter.bytes = 0;
+  init_file_list(&damaged);
+  // 检查整个磁盘且有清单时先按清单处理
+  int disk_id, name_len = 0;
+  struct Manifest manifest;
+  const bool has_manifest =
+      sscanf(dir_path, "disk_%d%n", &disk_id, &name_len) == 1 &&
+      dir_path[name_len] == '\0' && load_manifest(disk_id, &manifest);
+  const bool ok = walk_disk(dir_path, has_manifest ? &manifest : NULL,
+                            scrub_file, &damaged);
+  if (has_manifest)
+    del_manifest(&manifest);
+
+  report("Scrubbed %lld files (%lld bytes): %lld inconsistent stripes, "
+         "%lld repaired\n",
+         atomic_load(&scrub_stats.files), atomic_load(&scrub_stats.bytes),
+         atomic_load(&scrub_stats.inconsistent),
+         atomic_load(&scrub_stats.repaired));
+  for (int i = 0; i < damaged.size; i++)
+    report("Damaged: %s\n", damaged.names[i]);
+  del_file_list(&damaged);
+  pthread_mutex_unlock(&scrub_lock);
+  return ok;
+}
+
+/**
+ * @brief 命令行选项列表，has_value 表示该选项是否带参数，
+ * optional_value 表示可以用 "--name=value" 的形式带参数，也可以不带。
+ */
+struct Option_def {
+  const char *name;
+  bool has_value;
+  bool optional_value;
+};
+const struct Option_def OPTION_LIST[] = {
+    {"element-size", true, false},
+    {"threads", true, false},
+    {"io", true, false},
+    {"direct", false, false},
+    {"offset", true, false},
+    {"length", true, false},
+    {"write-back", false, false},
+    {"crc", false, false},
+    {"rate", true, false},
+    {"repair", false, false},
+    {"pack", false, false},
+    {"socket", true, false},
+    {"from-list", true, false},
+    {"code", true, false},
+    {"stats", false, true},
+};
+const int OPTION_NUM = sizeof(OPTION_LIST) / sizeof(OPTION_LIST[0]);
+
+/**
+ * @brief 设置一个选项的值。
+ * @param name 选项名（不含 "--"）
+ * @param value 选项参数，无参数时为 NULL
+ * @return 选项是否合法
+ */
+bool apply_option(const char *name, const char *value) {
+  if (strcmp(name, "element-size") == 0) {
+    int x = atoi(value);
+    if (x < MIN_ELEMENT_SIZE || x > MAX_ELEMENT_SIZE || (x & (x - 1)) != 0)
+      return false;
+    options.element_size = x;
+  } else if (strcmp(name, "io") == 0) {
+    if (strcmp(value, "uring") == 0)
+      options.io_uring = true;
+    else if (strcmp(value, "stdio") == 0)
+      options.io_uring = false;
+    else
+      return false;
+  } else if (strcmp(name, "direct") == 0) {
+    options.direct = true;
+  } else if (strcmp(name, "offset") == 0) {
+    options.offset = atoll(value);
+    if (options.offset < 0)
+      return false;
+  } else if (strcmp(name, "length") == 0) {
+    options.length = atoll(value);
+    if (options.length < 0)
+      return false;
+  } else if (strcmp(name, "write-back") == 0) {
+    options.write_back = true;
+  } else if (strcmp(name, "crc") == 0) {
+    options.crc = true;
+  } else if (strcmp(name, "rate") == 0) {
+    options.rate = atoll(value);
+    if (options.rate < 0)
+      return false;
+  } else if (strcmp(name, "repair") == 0) {
+    options.repair = true;
+  } else if (strcmp(name, "pack") == 0) {
+    options.pack = true;
+  } else if (strcmp(name, "socket") == 0) {
+    options.socket = value;
+  } else if (strcmp(name, "from-list") == 0) {
+    options.from_list = value;
+  } else if (strcmp(name, "code") == 0) {
+    if (strcmp(value, "evenodd") == 0)
+      options.code = CODE_EVENODD;
+    else if (strcmp(value, "rdp") == 0)
+      options.code = CODE_RDP;
+    else
+      return false;
+  } else if (strcmp(name, "stats") == 0) {
+    if (value == NULL || strcmp(value, "text") == 0)
+      options.stats = STATS_TEXT;
+    else if (strcmp(value, "json") == 0)
+      options.stats = STATS_JSON;
+    else
+      return false;
+  } else if (strcmp(name, "threads") == 0) {
+    options.threads = atoi(value);
+    if (options.threads < 1)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 解析 argv 中 "--name value" 或 "--name=value" 形式的选项，
+ * 并将其从 argv 中移除。
+ * @param argc 参数个数
+ * @param argv 参数列表，会被原地修改
+ * @return 移除选项后剩余的参数个数，选项不合法时返回 -1
+ * @example argc = parse_options(argc, argv);
+ */
+int parse_options(int argc, char **argv) {
+  int m = 0;
+
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      argv[m++] = argv[i];
+      continue;
+    }
+
+    char name[MAX_FILE_NAME_LENGTH];
+    const char *value = strchr(argv[i], '=');
+    int k;
+
+    snprintf(name, sizeof(name), "%s", argv[i] + 2);
+    if (value != NULL) {
+      name[value - argv[i] - 2] = '\0';
+      value++;
+    }
+    for (k = 0; k < OPTION_NUM; k++)
+      if (strcmp(name, OPTION_LIST[k].name) == 0)
+        break;
+    if (k == OPTION_NUM)
+      return -1;
+    if (OPTION_LIST[k].has_value && value == NULL) {
+      if (i + 1 == argc)
+        return -1;
+      value = argv[++i];
+    }
+    if (!OPTION_LIST[k].has_value && !OPTION_LIST[k].optional_value &&
+        value != NULL)
+      return -1;
+    if (!apply_option(name, value))
+      return -1;
+  }
+  return m;
+}
+
+void usage() {
+  report("./evenodd write <file_name> <p> [--element-size <bytes>] "
+         "[--threads <n>] [--crc] [--pack] [--code <evenodd|rdp>]\n");
+  report("  --element-size: a power of 2 in 8 ... 65536, "
+         "(p + 2) * p * bytes <= 256 MB\n");
+  report("./evenodd write -r <dir> <p> | --from-list <list_file> <p> "
+         "[--threads <n>]\n");
+  report("./evenodd read <file_name> <save_as> [--offset <bytes>] "
+         "[--length <bytes>] [--write-back]\n");
+  report("./evenodd read --from-list <list_file> [--threads <n>]\n");
+  report("./evenodd repair <number_erasures> <idx0> ... [--threads <n>]\n");
+  report("./evenodd update <file_name> <offset> <data_file>\n");
+  report("./evenodd scrub [disk_dir] [--threads <n>] [--rate <bytes/s>] "
+         "[--repair]\n");
+  report("./evenodd serve --socket <path> [--threads <workers>]\n");
+  report("./evenodd call <socket_path> <command> [args] ...\n");
+  report("common options: [--io <stdio|uring>] [--direct] "
+         "[--stats[=json]]\n");
+}
+
+/*
+ * 批量读写：在一个进程中依次加密 / 读出许多文件，省去每个文件启动进程的
+ * 开销。options.threads 个线程各自每次取下一个文件，单线程处理；读写缓存区
+ * 来自对齐缓存池，在文件之间复用。
+ */
+
+/**
+ * @brief 批量读写的共享状态。
+ */
+struct Bulk_walk {
+  const struct File_list *items;
+  atomic_llong next;   // 下一个要处理的项
+  atomic_llong failed; // 处理失败的项数
+  bool (*work)(const char *item, const int p);
+  int p;
+};
+
+void *bulk_worker(void *arg) {
+  struct Bulk_walk *walk = (struct Bulk_walk *)arg;
+  const int threads = options.threads;
+  long long i;
+
+  options.threads = 1; // 文件之间已经并行，每个文件内不再使用多线程
+  while ((i = atomic_fetch_add(&walk->next, 1)) < walk->items->size)
+    if (!walk->work(walk->items->names[i], walk->p))
+      atomic_fetch_add(&walk->failed, 1);
+  options.threads = threads;
+  return NULL;
+}
+
+/**
+ * @brief 以 options.threads 个线程对 items 中的每一项调用 work(item, p)。
+ * 某一项失败时继续处理其余各项。
+ * @return 是否全部成功
+ */
+bool bulk_walk(const struct File_list *items,
+               bool (*work)(const char *, const int), const int p) {
+  const int worker_num = min64(options.threads, max64(items->size, 1));
+  pthread_t threads[worker_num];
+  struct Bulk_walk walk;
+
+  walk.items = items;
+  walk.work = work;
+  walk.p = p;
+  atomic_init(&walk.next, 0);
+  atomic_init(&walk.failed, 0);
+  for (int i = 1; i < worker_num; i++)
+    create_thread(&threads[i], bulk_worker, &walk);
+  bulk_worker(&walk);
+  for (int i = 1; i < worker_num; i++)
+    join_thread(threads[i]);
+  return atomic_load(&walk.failed) == 0;
+}
+
+/**
+ * @brief 加密一个文件：options.pack 为 true 时追加到共享的容器中。
+ * @return 是否成功
+ */
+bool store_file(const char *file_name, const int p) {
+  return options.pack ? pack_file(file_name, p) : write_file(file_name, p);
+}
+
+/**
+ * @brief 处理读列表中的一行 "<file_name> <save_as>"。
+ * @return 是否成功
+ */
+bool read_list_item(const char *line, const int p) {
+  char file_name[MAX_FILE_NAME_LENGTH];
+  const int len = strcspn(line, " \t");
+  const char *save_as = line + len + strspn(line + len, " \t");
+
+  if (len >= MAX_FILE_NAME_LENGTH || *save_as == '\0') {
+    report("Invalid list line: %s\n", line);
+    return false;
+  }
+  memcpy(file_name, line, len);
+  file_name[len] = '\0';
+  return read_file(file_name, save_as);
+}
+
+/**
+ * @brief 把文件夹 dir_path 下（递归）的所有普通文件加入 list。
+ * dir_path 为 "." 时文件名不带 "./" 前缀，并跳过 disk_<i> 文件夹。
+ * @return NULL
+ */
+void list_directory(const char *dir_path, struct File_list *list) {
+  char path[MAX_FILE_NAME_LENGTH];
+  struct dirent *sub_dir;
+  int disk_id, name_len = 0;
+  DIR *root = opendir(dir_path);
+
+  if (root == NULL)
+    return;
+  while ((sub_dir = readdir(root)) != NULL) {
+    if (strcmp(sub_dir->d_name, ".") == 0 ||
+        strcmp(sub_dir->d_name, "..") == 0)
+      continue;
+    if (strcmp(dir_path, ".") == 0)
+      snprintf(path, MAX_FILE_NAME_LENGTH, "%s", sub_dir->d_name);
+    else
+      snprintf(path, MAX_FILE_NAME_LENGTH, "%s/%s", dir_path, sub_dir->d_name);
+    if (sscanf(path, "disk_%d%n", &disk_id, &name_len) == 1 &&
+        path[name_len] == '\0')
+      continue;
+
+    const mode_t mode = get_file_stat(path).st_mode;
+    if (S_ISDIR(mode))
+      list_directory(path, list);
+    else if (S_ISREG(mode))
+      file_list_add(list, path);
+  }
+  closedir(root);
+}
+
+/**
+ * @brief 把列表文件 list_path 中的非空行加入 list。
+ * @return 列表文件是否存在
+ */
+bool load_list(const char *list_path, struct File_list *list) {
+  FILE *file = fopen(list_path, "r");
+  char *line = NULL;
+  size_t capacity = 0;
+  long long len;
+
+  if (file == NULL)
+    return false;
+  while ((len = getline(&line, &capacity, file)) >= 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (len > 0)
+      file_list_add(list, line);
+  }
+  free(line);
+  fclose(file);
+  return true;
+}
+
+/**
+ * @brief 批量 write / read。
+ * write -r <dir> <p>：加密 dir 下的所有文件；
+ * write --from-list <list> <p>：加密 list 中每行给出的文件；
+ * read --from-list <list>：list 中每行为 "<file_name> <save_as>"。
+ * 某个文件失败时继续处理其余文件。
+ * @return 0 表示全部成功，1 表示有文件失败，-1 表示参数不合法
+ */
+int run_bulk(int argc, char **argv) {
+  struct File_list items;
+  bool ok = true;
+  const bool write = strcmp(argv[1], "write") == 0;
+  const bool recursive = argc > 2 && strcmp(argv[2], "-r") == 0;
+  int p = 0;
+
+  if (write && recursive && argc == 5)
+    p = atoi(argv[4]);
+  else if (write && !recursive && options.from_list != NULL && argc == 3)
+    p = atoi(argv[2]);
+  else if (strcmp(argv[1], "read") != 0 || recursive ||
+           options.from_list == NULL || argc != 2) {
+    usage();
+    return -1;
+  }
+
+  init_file_list(&items);
+  // 两种来源的路径都先收集完，加密过程中新建的 disk_<i> 文件不会被遍历到
+  if (recursive) {
+    for (int len = strlen(argv[3]); len > 1 && argv[3][len - 1] == '/';)
+      argv[3][--len] = '\0';
+    list_directory(argv[3], &items);
+  }
+  else if (!load_list(options.from_list, &items)) {
+    report("File does not exist!\n");
+    ok = false;
+  }
+  ok = bulk_walk(&items, write ? store_file : read_list_item, p) && ok;
+  del_file_list(&items);
+  return ok ? 0 : 1;
+}
+
+/**
+ * @brief 命令列表，min_argc 为该命令至少需要的参数个数（含程序名和操作名）。
+ */
+struct Command_def {
+  const char *name;
+  int min_argc;
+};
+const struct Command_def COMMAND_LIST[] = {
+    {"write", 4}, {"read", 4}, {"repair", 3}, {"update", 5}, {"scrub", 2},
+};
+const int COMMAND_NUM = sizeof(COMMAND_LIST) / sizeof(COMMAND_LIST[0]);
+
+/**
+ * @brief 执行一条命令。
+ * @param argc 参数个数（选项已由 parse_options 移除）
+ * @param argv 参数列表，argv[1] 为操作名
+ * @return 0 表示命令成功，1 表示命令失败（原因已由 report 输出），
+ * -1 表示参数不合法
+ */
+int execute_command(int argc, char **argv) {
+  bool ok;
+
+  if (argc < 2) {
+    usage();
+    return -1;
+  }
+
+  char *op = argv[1];
+  if (options.from_list != NULL || (argc > 2 && strcmp(argv[2], "-r") == 0))
+    return run_bulk(argc, argv);
+  for (int i = 0; i < COMMAND_NUM; i++)
+    if (strcmp(op, COMMAND_LIST[i].name) == 0 &&
+        argc < COMMAND_LIST[i].min_argc) {
+      usage();
+      return -1;
+    }
+  if (strcmp(op, "write") == 0) {
+    /*
+     * Please encode the input file with EVENODD code
      * and store the erasure-coded splits into corresponding disks
      * For example: Suppose "file_name" is "testfile", and "p" is 5. After
      * your encoding logic, there should be 7 splits, "testfile_0",
@@ -613,7 +4256,7 @@ int main(int argc, char **argv) {
      * "disk_6".
      * "p" is considered to be less or equal to 100.
      */
-    write(argv[2], atoi(argv[3]));
+    ok = store_file(argv[2], atoi(argv[3]));
   } else if (strcmp(op, "read") == 0) {
     /*
      * Please read the file specified by "file_name", and store it as a file
@@ -622,7 +4265,7 @@ int main(int argc, char **argv) {
      * before), and "save_as" is "tmp_file". After the read operation, there
      * should be a file named "tmp_file", which is the same as "testfile".
      */
-    read(argv[2], argv[3]);
+    ok = read_file(argv[2], argv[3]);
   } else if (strcmp(op, "repair") == 0) {
     /*
      * Please repair failed disks. The number of failures is specified by
@@ -633,12 +4276,353 @@ int main(int argc, char **argv) {
      * splits in folder "disk_0" and "disk_1" should be repaired.
      */
     int number_erasures = atoi(argv[2]);
+    if (number_erasures < 0 || argc < number_erasures + 3) {
+      usage();
+      return -1;
+    }
     int idx[number_erasures];
     for (int i = 0; i < number_erasures; i++)
       idx[i] = atoi(argv[i + 3]);
-    repair(number_erasures, idx);
+    ok = repair(number_erasures, idx);
+  } else if (strcmp(op, "update") == 0) {
+    /*
+     * Replace the bytes of "file_name" starting at "offset" with the
+     * content of "data_file", touching only the affected stripes.
+     */
+    ok = update_file(argv[2], atoll(argv[3]), argv[4]);
+  } else if (strcmp(op, "scrub") == 0) {
+    /*
+     * Check that the parity columns of every file agree with its data
+     * columns, optionally fixing the inconsistent stripes.
+     */
+    ok = scrub(argc > 2 ? argv[2] : NULL);
   } else {
-    printf("Non-supported operations!\n");
+    report("Non-supported operations!\n");
+    return -1;
+  }
+  return ok ? 0 : 1;
+}
+
+/**
+ * @brief --stats 开始计数时的时刻和进程的资源占用。
+ */
+struct Stats_start {
+  struct timespec wall;
+  struct rusage usage;
+};
+
+/**
+ * @brief 清空当前命令的 --stats 计数，记下开始的时刻。
+ * @return NULL
+ */
+void begin_stats(struct Stats_start *start) {
+  memset(stats, 0, sizeof(*stats));
+  clock_gettime(CLOCK_MONOTONIC, &start->wall);
+  getrusage(RUSAGE_SELF, &start->usage);
+}
+
+double timeval_seconds(const struct timeval *st, const struct timeval *ed) {
+  return (ed->tv_sec - st->tv_sec) + (ed->tv_usec - st->tv_usec) * 1e-6;
+}
+
+/**
+ * @brief 输出命令 command 的统计：按 options.stats 输出文本或一行 JSON。
+ * 总 CPU 时间取自 getrusage，是整个进程的用户态和内核态时间之和，
+ * serve 模式下包含同时执行的其他请求；各阶段的 CPU 时间只含本命令的线程。
+ * @return NULL
+ */
+void report_stats(const char *command, const struct Stats_start *start) {
+  const char *phase_name[] = {"read", "compute", "write"};
+  struct timespec wall;
+  struct rusage usage;
+
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  getrusage(RUSAGE_SELF, &usage);
+  const double wall_s = elapsed_ns(&start->wall, &wall) * 1e-9;
+  const double user_s =
+      timeval_seconds(&start->usage.ru_utime, &usage.ru_utime);
+  const double sys_s = timeval_seconds(&start->usage.ru_stime, &usage.ru_stime);
+  const bool json = options.stats == STATS_JSON;
+
+  report(json ? "{\"command\": \"%s\", \"wall_s\": %.6f, \"cpu_s\": %.6f, "
+                "\"user_s\": %.6f, \"sys_s\": %.6f, \"phases\": {"
+              : "Stats: %s, wall %.6f s, cpu %.6f s (user %.6f s, "
+                "sys %.6f s)\n",
+         command, wall_s, user_s + sys_s, user_s, sys_s);
+  for (int i = 0; i < PHASE_NUM; i++)
+    report(json ? "%s\"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}"
+                : "%s%s: wall %.6f s, cpu %.6f s\n",
+           json && i > 0 ? ", " : "", phase_name[i],
+           atomic_load(&stats->wall_ns[i]) * 1e-9,
+           atomic_load(&stats->cpu_ns[i]) * 1e-9);
+  report(json ? "}, \"read_calls\": %lld, \"write_calls\": %lld, "
+                "\"input_flushes\": %lld, \"output_flushes\": %lld, "
+                "\"stripes\": %lld, \"repair_files\": %lld, \"columns\": ["
+              : "read calls %lld, write calls %lld, input flushes %lld, "
+                "output flushes %lld\nstripes %lld, repair files %lld\n",
+         atomic_load(&stats->read_calls), atomic_load(&stats->write_calls),
+         atomic_load(&stats->input_flushes),
+         atomic_load(&stats->output_flushes),
+         atomic_load(&stats->stripes), atomic_load(&stats->repair_files));
+  for (int c = 1, first = true; c < MAX_P + 3; c++) {
+    const long long r = atomic_load(&stats->read_bytes[c]);
+    const long long w = atomic_load(&stats->write_bytes[c]);
+    if (r == 0 && w == 0)
+      continue;
+    report(json ? "%s{\"column\": %d, \"read_bytes\": %lld, "
+                  "\"write_bytes\": %lld}"
+                : "%scolumn %d: read %lld bytes, write %lld bytes\n",
+           json && !first ? ", " : "", c - 1, r, w);
+    first = false;
+  }
+  report(json ? "], \"other\": {\"read_bytes\": %lld, \"write_bytes\": %lld}}\n"
+              : "other files: read %lld bytes, write %lld bytes\n",
+         atomic_load(&stats->read_bytes[0]),
+         atomic_load(&stats->write_bytes[0]));
+}
+
+/**
+ * @brief 执行一条命令；使用 --stats 时在命令结束后输出统计。
+ * 命令的计数放在本函数的栈上，serve 模式下同时执行的请求互不影响。
+ * 命令在当前线程中处于计算阶段，读写和等待时除外。
+ * @param argc 参数个数（选项已由 parse_options 移除）
+ * @param argv 参数列表，argv[1] 为操作名
+ * @return 同 execute_command
+ */
+int run_command(int argc, char **argv) {
+  struct Stats command_stats; // 未使用 --stats 时不清空，也不会被读写
+  struct Stats *const last_stats = stats;
+  struct Stats_start start;
+  int status;
+
+  stats = &command_stats;
+  if (options.stats == STATS_OFF)
+    status = execute_command(argc, argv);
+  else {
+    begin_stats(&start);
+    const int last = enter_phase(PHASE_COMPUTE);
+    status = execute_command(argc, argv);
+    enter_phase(last);
+    if (status >= 0) // 命令失败时同样输出统计
+      report_stats(argv[1], &start);
+  }
+  stats = last_stats;
+  return status;
+}
+
+/*
+ * serve 模式：常驻进程在 UNIX 套接字上接收请求，每个请求相当于一次命令行
+ * 调用，省去每次启动进程、创建线程和申请缓存区的开销。
+ * 请求：4 字节长度 L + L 字节内容，内容为以 '\0' 结尾的各个参数（不含程序名），
+ *   例如 "write\0testfile\05\0--crc\0"；
+ * 回复：4 字节长度 L + L 字节内容，第一行为 "<status> <latency_us>"，
+ *   status 为 run_command 的返回值，latency_us 为服务端处理请求的微秒数，
+ *   之后是命令原本输出到 stdout 的内容。
+ * 一个连接上可以依次发送多个请求。相对路径相对于服务进程的工作目录。
+ */
+const int MAX_REQUEST_BYTES = 1 << 16; // 请求内容的最大字节数
+const int MAX_REQUEST_ARGS = 256;      // 请求中参数个数的最大值
+
+/**
+ * @brief 完整地从套接字读入 len 字节。
+ * @return 是否成功（对方关闭连接或出错时失败）
+ */
+bool recv_full(int fd, void *buf, long long len) {
+  long long got = 0, ret;
+
+  while (got < len && (ret = read(fd, (char *)buf + got, len - got)) > 0)
+    got += ret;
+  return got == len;
+}
+
+/**
+ * @brief 完整地向套接字写出 len 字节。
+ * @return 是否成功
+ */
+bool send_full(int fd, const void *buf, long long len) {
+  long long done = 0, ret;
+
+  while (done < len &&
+         (ret = write(fd, (const char *)buf + done, len - done)) > 0)
+    done += ret;
+  return done == len;
+}
+
+/**
+ * @brief 发送一帧：4 字节长度，之后依次为 head 和 body。
+ * @return 是否成功
+ */
+bool send_frame(int fd, const char *head, unsigned head_len, const char *body,
+                unsigned body_len) {
+  const unsigned len = head_len + body_len;
+
+  return send_full(fd, &len, 4) && send_full(fd, head, head_len) &&
+         send_full(fd, body, body_len);
+}
+
+/**
+ * @brief 执行一个请求并发送回复。
+ * @param fd 客户端连接
+ * @param request 请求内容，会被原地修改，末尾至少有 1 字节空余
+ * @param len 请求内容的字节数
+ * @return 是否成功发送回复
+ */
+bool serve_request(int fd, char *request, unsigned len) {
+  char *argv[MAX_REQUEST_ARGS + 1], *text, head[64], line[96];
+  size_t text_len;
+  struct timespec st, ed;
+  int argc = 1;
+
+  argv[0] = "evenodd";
+  request[len] = '\0';
+  for (char *s = request; s < request + len && argc < MAX_REQUEST_ARGS;
+       s += strlen(s) + 1)
+    argv[argc++] = s;
+  snprintf(line, sizeof(line), "%s %s", argc > 1 ? argv[1] : "",
+           argc > 2 ? argv[2] : "");
+
+  clock_gettime(CLOCK_MONOTONIC, &st);
+  options = (struct Options)DEFAULT_OPTIONS;
+  report_file = open_memstream(&text, &text_len);
+  argc = parse_options(argc, argv);
+  if (argc < 0)
+    usage();
+  const int status = argc < 0 ? -1 : run_command(argc, argv);
+  fclose(report_file);
+  report_file = NULL;
+  clock_gettime(CLOCK_MONOTONIC, &ed);
+
+  const long long latency =
+      (ed.tv_sec - st.tv_sec) * 1000000LL + (ed.tv_nsec - st.tv_nsec) / 1000;
+  const int head_len =
+      snprintf(head, sizeof(head), "%d %lld\n", status, latency);
+  const bool ok = send_frame(fd, head, head_len, text, text_len);
+  free(text);
+  report("%s: status %d, %lld us\n", line, status, latency);
+  fflush(stdout);
+  return ok;
+}
+
+/**
+ * @brief serve 的工作线程：逐个接受连接，依次处理连接上的请求。
+ * @param arg 指向监听套接字的指针
+ * @return NULL
+ */
+void *serve_worker(void *arg) {
+  const int listen_fd = *(int *)arg;
+  char *request = (char *)malloc(MAX_REQUEST_BYTES + 1);
+  unsigned len;
+
+  for (;;) {
+    const int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    while (recv_full(fd, &len, 4) && len <= MAX_REQUEST_BYTES &&
+           recv_full(fd, request, len) && serve_request(fd, request, len))
+      ;
+    close(fd);
+  }
+  free(request);
+  return NULL;
+}
+
+/**
+ * @brief 在 socket_path 上监听，用 options.threads 个常驻的工作线程处理请求。
+ * 只在出错时返回。
+ * @return NULL
+ */
+void serve(const char *socket_path) {
+  struct sockaddr_un addr;
+  const int worker_num = options.threads;
+  pthread_t workers[worker_num];
+
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    report("Invalid socket path!\n");
+    return;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socket_path);
+  if (listen_fd < 0 ||
+      bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd, SOMAXCONN) < 0) {
+    report("Cannot listen on %s!\n", socket_path);
+    return;
+  }
+  signal(SIGPIPE, SIG_IGN); // 客户端提前断开时不终止进程
+
+  for (int i = 0; i < worker_num; i++)
+    create_thread(&workers[i], serve_worker, &listen_fd);
+  report("Serving on %s with %d workers\n", socket_path, worker_num);
+  fflush(stdout);
+  for (int i = 0; i < worker_num; i++)
+    pthread_join(workers[i], NULL);
+}
+
+/**
+ * @brief 把 argv 中的命令发给 socket_path 上的服务进程，输出其结果。
+ * 服务端的处理时间写到 stderr。
+ * @return 命令的 status，连接失败时为 -1
+ */
+int call(const char *socket_path, int argc, char **argv) {
+  struct sockaddr_un addr;
+  long long len = 0, latency = 0;
+  int status = -1;
+  unsigned reply_len;
+
+  for (int i = 0; i < argc; i++)
+    len += strlen(argv[i]) + 1;
+  if (strlen(socket_path) >= sizeof(addr.sun_path) || len > MAX_REQUEST_BYTES) {
+    report("Invalid request!\n");
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    report("Cannot connect to %s!\n", socket_path);
+    return -1;
+  }
+
+  char request[len + 1];
+  len = 0;
+  for (int i = 0; i < argc; i++) {
+    strcpy(request + len, argv[i]);
+    len += strlen(argv[i]) + 1;
+  }
+  if (send_frame(fd, "", 0, request, len) && recv_full(fd, &reply_len, 4)) {
+    char *reply = (char *)malloc(reply_len + 1);
+    if (recv_full(fd, reply, reply_len)) {
+      reply[reply_len] = '\0';
+      const char *text = strchr(reply, '\n');
+      text = text != NULL ? text + 1 : reply + reply_len;
+      sscanf(reply, "%d %lld", &status, &latency);
+      fwrite(text, 1, reply + reply_len - text, stdout);
+      fprintf(stderr, "Latency: %lld us\n", latency);
+    }
+    free(reply);
+  }
+  close(fd);
+  return status;
+}
+
+int main(int argc, char **argv) {
+  evenodd_init();
+  // int id[]= {0};
+  // repair(1, id);
+  // return 0;
+  if (argc > 2 && strcmp(argv[1], "call") == 0)
+    return call(argv[2], argc - 3, argv + 3);
+  argc = parse_options(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+    if (options.socket == NULL)
+      usage();
+    else
+      serve(options.socket);
+    return -1;
   }
-  return 0;
+  return run_command(argc, argv);
 }
@@ -0,0 +1,346 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#include "evenodd_kernel.h"
+#include "libevenodd.h"
+
+/*
+ * evenodd_bench：在内存中测量编码 / 解码内核的吞吐量，不经过文件系统。
+ * 对每个质数（EVENODD 为 3 ... 97，RDP 为 5 ... 97）生成约 --size 字节的
+ * 随机数据，依次测量：
+ *   row_parity：行校验（第 p 列），即 calc_row_parity；
+ *   diag_parity：对角线校验（第 p + 1 列），即 calc_diag_parity /
+ *     rdp_calc_diag_parity；
+ *   encode / encode_batch：get_codec 取得的特化编码函数；
+ *   decode：repair_work 的每种解码情形（只坏校验列、一个数据列、数据列加
+ *     行校验列 / 对角线校验列、两个数据列），每个条带先清零损坏的列再解码，
+ *     最后核对解出的数据。
+ * 每项重复 --repeat 次（另有一次预热），输出平均吞吐量（按数据列字节数
+ * 计）、标准差、最小 / 最大值和每字节的 TSC 周期数。
+ */
+
+const long long DEFAULT_BENCH_BYTES = 32LL << 20;
+const int DEFAULT_REPEAT = 5;
+const int MAX_REPEAT = 1000;
+const int MAX_PRIME = 97;
+
+struct Bench_options {
+  int code;       // 只测该编码方式，-1 表示都测
+  int prime;      // 只测该质数，0 表示都测
+  int w;          // 每个元素包含的 uint64 个数
+  long long size; // 每项测量的数据字节数
+  int repeat;     // 重复次数
+  bool json;      // 每行输出一个 JSON 对象
+};
+
+/**
+ * @brief 一个测量项：name 为名称，lost 为 decode 时损坏的列（第 p、p + 1
+ * 列分别记为 -1、-2，以便对所有 p 通用），lost_num 为损坏列数。
+ */
+struct Bench_case {
+  const char *name;
+  int lost[2];
+  int lost_num;
+};
+
+const struct Bench_case BENCH_CASES[] = {
+    {"row_parity", {0, 0}, 0},  {"diag_parity", {0, 0}, 0},
+    {"encode", {0, 0}, 0},      {"encode_batch", {0, 0}, 0},
+    {"decode", {-1, 0}, 1},     {"decode", {-2, 0}, 1},
+    {"decode", {-1, -2}, 2},    {"decode", {0, 0}, 1},
+    {"decode", {0, -1}, 2},     {"decode", {0, -2}, 2},
+    {"decode", {0, 1}, 2},
+};
+const int BENCH_CASE_NUM = sizeof(BENCH_CASES) / sizeof(BENCH_CASES[0]);
+
+/**
+ * @brief 一个质数的测量数据。
+ * stripe 中依次存放 k 个条带，每个条带 p + 2 列，每列 q * w 个 uint64
+ * （最后一个元素为 0），与 repair_work 解码时的布局相同；data、out 为
+ * encode_batch 的输入和输出。
+ */
+struct Bench_data {
+  struct File_info info;
+  struct Codec codec;
+  int p, q, w, n;       // n = (q - 1) * w，每个条带中每列的 uint64 个数
+  long long k;          // 条带数
+  long long data_bytes; // k 个条带的数据列字节数
+  uint64 *stripe, *work, *data, *out;
+};
+
+uint64 *column(const struct Bench_data *d, long long s, int i) {
+  return d->stripe + (s * (d->p + 2) + i) * d->q * d->w;
+}
+
+uint64 next_random(uint64 *x) {
+  *x ^= *x << 13;
+  *x ^= *x >> 7;
+  *x ^= *x << 17;
+  return *x;
+}
+
+/**
+ * @brief 对 k 个条带中第 i 列的内容求一个校验值，用于核对解码结果。
+ */
+uint64 column_hash(const struct Bench_data *d, int i) {
+  uint64 h = 0;
+
+  for (long long s = 0; s < d->k; s++) {
+    const uint64 *x = column(d, s, i);
+    for (int l = 0; l < d->n; l++)
+      h = (h ^ x[l]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+/**
+ * @brief 生成 k 个条带的随机数据并编码。
+ * @return 是否成功分配内存
+ */
+bool init_bench_data(struct Bench_data *d, int code, int prime,
+                     const struct Bench_options *options) {
+  uint64 seed = 0x9e3779b97f4a7c15ULL ^ prime;
+
+  d->info.p = code == CODE_RDP ? prime - 1 : prime;
+  d->info.w = options->w;
+  d->info.crc = false;
+  d->info.code = code;
+  d->codec = get_codec(&d->info);
+  d->p = d->info.p;
+  d->q = prime;
+  d->w = options->w;
+  d->n = (d->q - 1) * d->w;
+  d->k = (options->size + 8LL * d->p * d->n - 1) / (8LL * d->p * d->n);
+  d->data_bytes = 8LL * d->k * d->p * d->n;
+  d->info.file_size = d->data_bytes;
+
+  d->stripe = (uint64 *)calloc(d->k * (d->p + 2) * d->q * d->w, 8);
+  d->work = (uint64 *)malloc(8LL * (2 * d->q + 1) * d->w);
+  d->data = (uint64 *)malloc(d->data_bytes);
+  d->out = (uint64 *)malloc(8LL * d->k * (d->p + 2) * d->n);
+  if (d->stripe == NULL || d->work == NULL || d->data == NULL ||
+      d->out == NULL)
+    return false;
+
+  for (long long s = 0; s < d->k; s++) {
+    uint64 *col[d->p + 2];
+    for (int i = 0; i < d->p + 2; i++)
+      col[i] = column(d, s, i);
+    for (int i = 0; i < d->p; i++)
+      for (int l = 0; l < d->n; l++)
+        col[i][l] = next_random(&seed);
+    for (int i = 0; i < d->p; i++)
+      memcpy(d->data + (s * d->p + i) * d->n, col[i], 8LL * d->n);
+    d->codec.encode(col, d->p, d->w);
+  }
+  return true;
+}
+
+void free_bench_data(struct Bench_data *d) {
+  free(d->stripe);
+  free(d->work);
+  free(d->data);
+  free(d->out);
+}
+
+/**
+ * @brief 把一个测量项在 k 个条带上执行一遍。
+ * @param plan decode 使用的解码计划，其他测量项为 NULL
+ * @param lost 损坏的列
+ * @return NULL
+ */
+void run_case(const struct Bench_data *d, const struct Bench_case *c,
+              const struct Decode_plan *plan, const int *lost) {
+  const int p = d->p, w = d->w;
+  uint64 *col[p + 2], *out[p + 2];
+
+  if (strcmp(c->name, "encode_batch") == 0) {
+    for (int i = 0; i < p + 2; i++)
+      out[i] = d->out + (long long)i * d->k * d->n;
+    d->codec.encode_batch(d->data, out, d->k, p, w);
+    return;
+  }
+  for (long long s = 0; s < d->k; s++) {
+    for (int i = 0; i < p + 2; i++)
+      col[i] = column(d, s, i);
+    if (plan != NULL) {
+      for (int e = 0; e < c->lost_num; e++)
+        memset(col[lost[e]], 0, 8LL * d->n);
+      d->codec.decode(col, plan, d->work, p, w);
+    } else if (strcmp(c->name, "row_parity") == 0)
+      xor_kernel.xor_gather(col[p], (const uint64 *const *)col, p, d->n);
+    else if (strcmp(c->name, "diag_parity") == 0) {
+      if (d->info.code == CODE_RDP)
+        rdp_calc_diag_parity(col, p, w);
+      else
+        calc_diag_parity(col[p + 1], col, p, w);
+    } else
+      d->codec.encode(col, p, w);
+  }
+}
+
+double elapsed(const struct timespec *st, const struct timespec *ed) {
+  return (ed->tv_sec - st->tv_sec) + (ed->tv_nsec - st->tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief 测量一项并输出一行结果。
+ * @return 解码结果是否正确（其他测量项总是 true）
+ */
+bool bench_case(const struct Bench_data *d, const struct Bench_case *c,
+                const struct Bench_options *options) {
+  const char *code_name = d->info.code == CODE_RDP ? "rdp" : "evenodd";
+  const struct Decode_plan *plan = NULL;
+  double gbps[MAX_REPEAT], sum = 0, sum2 = 0, lo = INFINITY, hi = 0;
+  unsigned long long cycles = 0;
+  uint64 hash[2];
+  int lost[2];
+  char lost_text[32] = "-", lost_json[32] = "[]";
+  bool ok = true;
+
+  for (int e = 0; e < c->lost_num; e++) {
+    lost[e] = c->lost[e] < 0 ? d->p - 1 - c->lost[e] : c->lost[e];
+    hash[e] = column_hash(d, lost[e]);
+  }
+  if (c->lost_num > 0) {
+    plan = get_decode_plan(&d->info, lost, c->lost_num);
+    if (c->lost_num == 1) {
+      sprintf(lost_text, "%d", lost[0]);
+      sprintf(lost_json, "[%d]", lost[0]);
+    } else {
+      sprintf(lost_text, "%d,%d", lost[0], lost[1]);
+      sprintf(lost_json, "[%d, %d]", lost[0], lost[1]);
+    }
+  }
+
+  run_case(d, c, plan, lost); // 预热
+  for (int t = 0; t < options->repeat; t++) {
+    struct timespec st, ed;
+    unsigned long long c0, c1;
+
+    clock_gettime(CLOCK_MONOTONIC, &st);
+    c0 = __rdtsc();
+    run_case(d, c, plan, lost);
+    c1 = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &ed);
+    gbps[t] = d->data_bytes / elapsed(&st, &ed) * 1e-9;
+    cycles += c1 - c0;
+    sum += gbps[t];
+    lo = fmin(lo, gbps[t]);
+    hi = fmax(hi, gbps[t]);
+  }
+  for (int e = 0; e < c->lost_num; e++)
+    ok &= column_hash(d, lost[e]) == hash[e];
+
+  const double mean = sum / options->repeat;
+  const double cpb = (double)cycles / options->repeat / d->data_bytes;
+  for (int t = 0; t < options->repeat; t++)
+    sum2 += (gbps[t] - mean) * (gbps[t] - mean);
+  const double stddev = sqrt(sum2 / options->repeat);
+
+  if (options->json)
+    printf("{\"code\": \"%s\", \"prime\": %d, \"p\": %d, \"element_size\": %d, "
+           "\"case\": \"%s\", \"lost\": %s, \"bytes\": %lld, "
+           "\"repeat\": %d, \"gbps\": %.4f, \"gbps_stddev\": %.4f, "
+           "\"gbps_min\": %.4f, \"gbps_max\": %.4f, "
+           "\"cycles_per_byte\": %.4f, \"kernel\": \"%s\", \"ok\": %s}\n",
+           code_name, d->q, d->p, 8 * d->w, c->name, lost_json, d->data_bytes,
+           options->repeat, mean, stddev, lo, hi, cpb, xor_kernel.name,
+           ok ? "true" : "false");
+  else
+    printf("%-8s %5d %5d %-12s %-7s %9.3f %8.3f %9.3f %9.3f %8.3f%s\n",
+           code_name, d->q, d->p, c->name, lost_text, mean, stddev, lo, hi,
+           cpb, ok ? "" : "  WRONG");
+  fflush(stdout);
+  return ok;
+}
+
+void usage() {
+  fprintf(stderr, "./evenodd_bench [--code <evenodd|rdp>] [--prime <p>] "
+                  "[--element-size <bytes>] [--size <bytes>] [--repeat <n>] "
+                  "[--json]\n");
+}
+
+/**
+ * @brief 解析命令行参数。
+ * @return 参数是否合法
+ */
+bool parse_bench_options(int argc, char **argv, struct Bench_options *options) {
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (strcmp(argv[i], "--json") == 0) {
+      options->json = true;
+      continue;
+    }
+    if (value == NULL)
+      return false;
+    i++;
+    if (strcmp(argv[i - 1], "--code") == 0) {
+      if (strcmp(value, "evenodd") == 0)
+        options->code = CODE_EVENODD;
+      else if (strcmp(value, "rdp") == 0)
+        options->code = CODE_RDP;
+      else
+        return false;
+    } else if (strcmp(argv[i - 1], "--prime") == 0) {
+      options->prime = atoi(value);
+      if (options->prime > MAX_PRIME || !is_prime(options->prime))
+        return false;
+    } else if (strcmp(argv[i - 1], "--element-size") == 0) {
+      const long long bytes = atoll(value);
+      if (bytes < 8 || bytes % 8 != 0 || (bytes & (bytes - 1)) != 0)
+        return false;
+      options->w = bytes / 8;
+    } else if (strcmp(argv[i - 1], "--size") == 0) {
+      options->size = atoll(value);
+      if (options->size <= 0)
+        return false;
+    } else if (strcmp(argv[i - 1], "--repeat") == 0) {
+      options->repeat = atoi(value);
+      if (options->repeat < 1 || options->repeat > MAX_REPEAT)
+        return false;
+    } else
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  struct Bench_options options = {-1, 0, 1, DEFAULT_BENCH_BYTES,
+                                  DEFAULT_REPEAT, false};
+  bool ok = true;
+
+  if (!parse_bench_options(argc, argv, &options)) {
+    usage();
+    return 1;
+  }
+  evenodd_init();
+  init_xor_kernel();
+  if (!options.json)
+    printf("%-8s %5s %5s %-12s %-7s %9s %8s %9s %9s %8s\n", "code", "prime",
+           "p", "case", "lost", "GB/s", "stddev", "min", "max", "cyc/B");
+
+  for (int code = CODE_EVENODD; code <= CODE_RDP; code++) {
+    if (options.code >= 0 && code != options.code)
+      continue;
+    for (int prime = code == CODE_RDP ? 5 : 3; prime <= MAX_PRIME; prime++) {
+      struct Bench_data d;
+
+      if (!is_prime(prime) || (options.prime != 0 && prime != options.prime))
+        continue;
+      if (!init_bench_data(&d, code, prime, &options)) {
+        fprintf(stderr, "Out of memory!\n");
+        return 1;
+      }
+      for (int c = 0; c < BENCH_CASE_NUM; c++)
+        ok &= bench_case(&d, &BENCH_CASES[c], &options);
+      free_bench_data(&d);
+    }
+  }
+  return ok ? 0 : 1;
+}
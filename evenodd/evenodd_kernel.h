@@ -0,0 +1,572 @@
+#ifndef EVENODD_KERNEL_H
+#define EVENODD_KERNEL_H
+
+#include <immintrin.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned long long uint64;
+
+// 元素为 8 字节时，p 小于 UNROLL_MAX_P 的条带逐字编解码（见 encode_stripe），
+// 否则调用 XOR 内核；其中 p 小于 ENCODE_ROW_MAJOR_P 时编码按行展开
+static const int UNROLL_MAX_P = 37;
+static const int ENCODE_ROW_MAJOR_P = 19;
+// 批量编码时 p 小于 BATCH_FUSED_P 的条带逐条带展开（见 encode_batch）
+static const int BATCH_FUSED_P = 7;
+
+/**
+ * @brief XOR 内核函数表。
+ * 所有内核只依赖两个基本操作：
+ * xor_into(dst, src, n)：dst[k] ^= src[k]，0 <= k < n；
+ * xor_gather(dst, src, m, n)：dst[k] = src[0][k] ^ ... ^ src[m - 1][k]。
+ * 程序启动时由 init_xor_kernel() 根据 CPUID 选出最快的一组实现。
+ */
+struct Xor_kernel {
+  const char *name;
+  void (*xor_into)(uint64 *dst, const uint64 *src, long long n);
+  void (*xor_gather)(uint64 *dst, const uint64 *const *src, int m,
+                     long long n);
+};
+
+static void xor_into_scalar(uint64 *dst, const uint64 *src, long long n) {
+  for (long long k = 0; k < n; k++)
+    dst[k] ^= src[k];
+}
+static void xor_gather_scalar(uint64 *dst, const uint64 *const *src, int m,
+                              long long n) {
+  if (m == 0) {
+    memset(dst, 0, n << 3);
+    return;
+  }
+  memcpy(dst, src[0], n << 3);
+  for (int i = 1; i < m; i++)
+    xor_into_scalar(dst, src[i], n);
+}
+
+/*
+ * 各指令集版本写法相同：每次处理 4 个向量寄存器宽度，
+ * xor_gather 在寄存器里累加全部 m 个来源后只写回一次 dst，
+ * 不足 4 个向量的尾部交给标量版本处理。
+ */
+#define XOR_KERNEL_DEFINE(isa, isa_name, vec, width, load, store, xor)         \
+  __attribute__((target(isa_name))) static void xor_into_##isa(                \
+      uint64 *dst, const uint64 *src, long long n) {                           \
+    long long k = 0;                                                           \
+    for (; k + 4 * (width) <= n; k += 4 * (width)) {                           \
+      vec _x0 = xor(load(dst + k), load(src + k));                             \
+      vec _x1 = xor(load(dst + k + (width)), load(src + k + (width)));         \
+      vec _x2 = xor(load(dst + k + 2 * (width)), load(src + k + 2 * (width))); \
+      vec _x3 = xor(load(dst + k + 3 * (width)), load(src + k + 3 * (width))); \
+      store(dst + k, _x0);                                                     \
+      store(dst + k + (width), _x1);                                           \
+      store(dst + k + 2 * (width), _x2);                                       \
+      store(dst + k + 3 * (width), _x3);                                       \
+    }                                                                          \
+    xor_into_scalar(dst + k, src + k, n - k);                                  \
+  }                                                                            \
+  __attribute__((target(isa_name))) static void xor_gather_##isa(              \
+      uint64 *dst, const uint64 *const *src, int m, long long n) {             \
+    long long k = 0;                                                           \
+    if (m == 0) {                                                              \
+      memset(dst, 0, n << 3);                                                  \
+      return;                                                                  \
+    }                                                                          \
+    for (; k + 4 * (width) <= n; k += 4 * (width)) {                           \
+      vec _x0 = load(src[0] + k);                                              \
+      vec _x1 = load(src[0] + k + (width));                                    \
+      vec _x2 = load(src[0] + k + 2 * (width));                                \
+      vec _x3 = load(src[0] + k + 3 * (width));                                \
+      for (int _i = 1; _i < m; _i++) {                                         \
+        _x0 = xor(_x0, load(src[_i] + k));                                     \
+        _x1 = xor(_x1, load(src[_i] + k + (width)));                           \
+        _x2 = xor(_x2, load(src[_i] + k + 2 * (width)));                       \
+        _x3 = xor(_x3, load(src[_i] + k + 3 * (width)));                       \
+      }                                                                        \
+      store(dst + k, _x0);                                                     \
+      store(dst + k + (width), _x1);                                           \
+      store(dst + k + 2 * (width), _x2);                                       \
+      store(dst + k + 3 * (width), _x3);                                       \
+    }                                                                          \
+    if (k < n) {                                                               \
+      memcpy(dst + k, src[0] + k, (n - k) << 3);                               \
+      for (int _i = 1; _i < m; _i++)                                           \
+        xor_into_scalar(dst + k, src[_i] + k, n - k);                          \
+    }                                                                          \
+  }
+
+#define LOAD_SSE2(x) _mm_loadu_si128((const __m128i *)(x))
+#define STORE_SSE2(x, v) _mm_storeu_si128((__m128i *)(x), v)
+#define LOAD_AVX2(x) _mm256_loadu_si256((const __m256i *)(x))
+#define STORE_AVX2(x, v) _mm256_storeu_si256((__m256i *)(x), v)
+#define LOAD_AVX512(x) _mm512_loadu_si512((const void *)(x))
+#define STORE_AVX512(x, v) _mm512_storeu_si512((void *)(x), v)
+
+XOR_KERNEL_DEFINE(sse2, "sse2", __m128i, 2, LOAD_SSE2, STORE_SSE2,
+                  _mm_xor_si128)
+XOR_KERNEL_DEFINE(avx2, "avx2", __m256i, 4, LOAD_AVX2, STORE_AVX2,
+                  _mm256_xor_si256)
+XOR_KERNEL_DEFINE(avx512, "avx512f", __m512i, 8, LOAD_AVX512, STORE_AVX512,
+                  _mm512_xor_si512)
+
+static const struct Xor_kernel XOR_KERNELS[] = {
+    {"avx512", xor_into_avx512, xor_gather_avx512},
+    {"avx2", xor_into_avx2, xor_gather_avx2},
+    {"sse2", xor_into_sse2, xor_gather_sse2},
+    {"scalar", xor_into_scalar, xor_gather_scalar},
+};
+static const int XOR_KERNEL_NUM = sizeof(XOR_KERNELS) / sizeof(XOR_KERNELS[0]);
+
+static struct Xor_kernel xor_kernel = {"scalar", xor_into_scalar,
+                                       xor_gather_scalar};
+
+/**
+ * @brief 根据 CPUID 选择 XOR 内核。
+ * 可用环境变量 EVENODD_KERNEL 强制指定（"avx512"、"avx2"、"sse2"、
+ * "scalar"），指定的指令集不被支持时仍按 CPUID 选择。
+ * @return NULL
+ */
+static void init_xor_kernel() {
+  const char *forced = getenv("EVENODD_KERNEL");
+  bool supported[4];
+
+  __builtin_cpu_init();
+  supported[0] = __builtin_cpu_supports("avx512f");
+  supported[1] = __builtin_cpu_supports("avx2");
+  supported[2] = __builtin_cpu_supports("sse2");
+  supported[3] = true;
+
+  for (int i = 0; forced != NULL && i < XOR_KERNEL_NUM; i++)
+    if (supported[i] && strcmp(forced, XOR_KERNELS[i].name) == 0) {
+      xor_kernel = XOR_KERNELS[i];
+      return;
+    }
+  for (int i = 0; i < XOR_KERNEL_NUM; i++)
+    if (supported[i]) {
+      xor_kernel = XOR_KERNELS[i];
+      return;
+    }
+}
+
+/*
+ * CRC32C（Castagnoli 多项式），用于校验列文件中的数据块。
+ * 支持 SSE4.2 时使用 crc32 指令，否则查表计算；由 init_crc32c() 选择。
+ */
+static unsigned crc32c_table[256];
+
+static unsigned crc32c_soft(unsigned crc, const void *buf, long long len) {
+  const unsigned char *s = (const unsigned char *)buf;
+
+  crc = ~crc;
+  while (len--)
+    crc = crc32c_table[(crc ^ *s++) & 255] ^ (crc >> 8);
+  return ~crc;
+}
+
+__attribute__((target("sse4.2"))) static unsigned
+crc32c_sse42(unsigned crc, const void *buf, long long len) {
+  const unsigned char *s = (const unsigned char *)buf;
+  uint64 c = ~crc & 0xffffffffULL, x;
+
+  for (; len >= 8; len -= 8, s += 8) {
+    memcpy(&x, s, 8);
+    c = _mm_crc32_u64(c, x);
+  }
+  for (; len > 0; len--)
+    c = _mm_crc32_u8(c, *s++);
+  return ~(unsigned)c;
+}
+
+/**
+ * @brief 计算 buf 的 CRC32C，crc 为之前部分的结果（初始为 0）。
+ */
+static unsigned (*crc32c)(unsigned crc, const void *buf,
+                          long long len) = crc32c_soft;
+
+static inline void init_crc32c() {
+  for (unsigned i = 0; i < 256; i++) {
+    unsigned x = i;
+    for (int k = 0; k < 8; k++)
+      x = (x >> 1) ^ (0x82f63b78 & -(x & 1));
+    crc32c_table[i] = x;
+  }
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+    crc32c = crc32c_sse42;
+}
+
+// 线程结束时由 pthread_key_create 登记的 free 释放该线程的临时缓存区
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void create_scratch_key(void) { pthread_key_create(&scratch_key, free); }
+
+/**
+ * @brief 取得当前线程的临时缓存区，长度至少为 n 个 uint64。
+ * 缓存区只增不减，避免每个条带都申请一次大块内存；线程结束时释放，
+ * 修复、遍历等短暂的线程不会泄漏。申请失败时输出错误并终止进程。
+ * @param n 需要的长度
+ * @return 缓存区首地址
+ */
+static uint64 *get_scratch(long long n) {
+  static __thread uint64 *scratch = NULL;
+  static __thread long long scratch_size = 0;
+
+  if (scratch_size < n) {
+    pthread_once(&scratch_once, create_scratch_key);
+    free(scratch);
+    scratch = (uint64 *)malloc(n << 3);
+    if (scratch == NULL) {
+      fputs("Out of memory!\n", stderr);
+      abort();
+    }
+    scratch_size = n;
+    pthread_setspecific(scratch_key, scratch);
+  }
+  return scratch;
+}
+
+/**
+ * @brief 计算 dst = x ^ y，三者长度均为 n 个 uint64。
+ * @return NULL
+ */
+static inline void xor_pair(uint64 *dst, const uint64 *x, const uint64 *y,
+                            long long n) {
+  const uint64 *src[2] = {x, y};
+
+  if (n == 1)
+    *dst = *x ^ *y;
+  else
+    xor_kernel.xor_gather(dst, src, 2, n);
+}
+
+/*
+ * 以下为 EVENODD 的四个计算内核。
+ * 每个元素（symbol）由 w 个连续的 uint64 组成，col[i] 指向第 i 列的
+ * p - 1 个元素，即 (p - 1) * w 个 uint64。
+ */
+
+/**
+ * @brief 计算行校验（第 p 列）。
+ * @param res 结果，长度 p - 1 个元素
+ * @param col 第 0 ... (p - 1) 列
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static void calc_row_parity(uint64 *res, uint64 *const *col, const int p,
+                            const int w) {
+  xor_kernel.xor_gather(res, (const uint64 *const *)col, p,
+                        (long long)(p - 1) * w);
+}
+
+/**
+ * @brief 计算各条对角线的异或和（不含第 p + 1 列），结果为 2p - 1 个元素。
+ * 第 i 列第 j 个元素落在第 i + j 条（未取模的）对角线上。
+ * @return 存放结果的临时缓存区
+ */
+static uint64 *calc_diag_sums(uint64 *const *col, const int p, const int w) {
+  const long long n = (long long)(p - 1) * w;
+  uint64 *b = get_scratch((2 * p - 1) * (long long)w);
+
+  memset(b, 0, ((2 * p - 1) * (long long)w) << 3);
+  for (int i = 0; i < p; i++)
+    xor_kernel.xor_into(b + (long long)i * w, col[i], n);
+  return b;
+}
+
+/**
+ * @brief 计算对角线异或和 S。
+ * res[l] 为第 l 条对角线（不含第 p + 1 列）的异或和，l = 0 ... p - 1，
+ * 其中 res[p - 1] 为调整因子。
+ * @param res 结果，长度 p 个元素
+ * @param col 第 0 ... (p - 1) 列
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static inline void calc_diag_syndrome(uint64 *res, uint64 *const *col,
+                                      const int p, const int w) {
+  const long long n = (long long)(p - 1) * w;
+  uint64 *b = calc_diag_sums(col, p, w);
+  const uint64 *half[2] = {b, b + (long long)p * w};
+
+  xor_kernel.xor_gather(res, half, 2, n);
+  memcpy(res + n, b + n, (long long)w << 3);
+}
+
+/**
+ * @brief 计算对角线校验（第 p + 1 列）。
+ * @param res 结果，长度 p - 1 个元素
+ * @param col 第 0 ... (p - 1) 列
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static void calc_diag_parity(uint64 *res, uint64 *const *col, const int p,
+                             const int w) {
+  const long long n = (long long)(p - 1) * w;
+  uint64 *b = calc_diag_sums(col, p, w);
+  const uint64 *src[3] = {b, b + n, b + n + w};
+
+  if (w == 1) {
+    for (int l = 0; l < p - 1; l++)
+      res[l] = b[l] ^ b[p - 1] ^ b[l + p];
+    return;
+  }
+  for (int l = 0; l < p - 1; l++, src[0] += w, src[2] += w)
+    xor_kernel.xor_gather(res + (long long)l * w, src, 3, w);
+}
+
+/**
+ * @brief 用第 0 ... p 列中完好的列修复唯一损坏的一列。
+ * @param res 结果，长度 p - 1 个元素
+ * @param col 第 0 ... p 列
+ * @param check_disk 为 true 表示该列完好
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static inline void calc_single_column(uint64 *res, uint64 *const *col,
+                                      const bool *check_disk, const int p,
+                                      const int w) {
+  const uint64 *src[p + 1];
+  int m = 0;
+
+  for (int i = 0; i < p + 1; i++)
+    if (check_disk[i])
+      src[m++] = col[i];
+  xor_kernel.xor_gather(res, src, m, (long long)(p - 1) * w);
+}
+
+/**
+ * @brief 计算一个条带的两个校验列（第 p 列和第 p + 1 列）。
+ * 总是内联：以常量 p 调用时，循环边界和下标运算都可以在编译期确定，
+ * 见 evenodd.c 中按质数特化的 CODEC_DEFINE。
+ * @param col 第 0 ... (p + 1) 列，每列 p - 1 个元素
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+encode_stripe(uint64 *const *col, const int p, const int w) {
+  if (w == 1 && p < UNROLL_MAX_P) { // 逐字计算，不调用 XOR 内核
+    uint64 r[p - 1], b[2 * p - 1];
+
+    memset(b, 0, sizeof(b));
+    if (p < ENCODE_ROW_MAJOR_P) { // p 较小：逐行计算，整行可以完全展开
+      for (int l = 0; l < p - 1; l++) {
+        uint64 x = col[0][l];
+        for (int i = 1; i < p; i++)
+          x ^= col[i][l];
+        r[l] = x;
+      }
+      for (int i = 0; i < p; i++)
+        for (int l = 0; l < p - 1; l++)
+          b[i + l] ^= col[i][l];
+    } else { // p 较大：逐列计算，内层循环可以向量化
+      memcpy(r, col[0], sizeof(r));
+      memcpy(b, col[0], sizeof(r));
+      for (int i = 1; i < p; i++)
+        for (int l = 0; l < p - 1; l++) {
+          r[l] ^= col[i][l];
+          b[i + l] ^= col[i][l];
+        }
+    }
+    memcpy(col[p], r, sizeof(r));
+    for (int l = 0; l < p - 1; l++)
+      col[p + 1][l] = b[l] ^ b[p - 1] ^ b[l + p];
+    return;
+  }
+  calc_row_parity(col[p], col, p, w);
+  calc_diag_parity(col[p + 1], col, p, w);
+}
+
+/**
+ * @brief 批量编码 k 个条带。
+ * data 中 k 个条带依次存放，每个条带为第 0 ... (p - 1) 列各 n 个 uint64
+ * （即原文件的顺序）；out[i] 为第 i 列的输出，k 个条带的该列依次存放。
+ * 一般先把数据列按列整理到 out 中，此后各列的 k 个条带连续，行校验对整批
+ * 只做一次长度为 k * n 的异或；对角线校验逐条带计算，所读的数据刚写入
+ * out，仍在缓存中。k 应使 out 中的数据能放进 L2 缓存。
+ * p 很小时每列只有几个字，改为逐条带完全展开，复制数据的同时累加校验。
+ * @param data k 个条带的数据
+ * @param out p + 2 列的输出，各 k * n 个 uint64
+ * @param k 条带数
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+encode_batch(const uint64 *data, uint64 *const *out, const long long k,
+             const int p, const int w) {
+  const long long n = (long long)(p - 1) * w;
+  uint64 *col[p];
+
+  if (w == 1 && p < BATCH_FUSED_P) {
+    for (long long s = 0; s < k; s++, data += p * n) {
+      uint64 r[p - 1], b[2 * p - 1];
+
+      for (int l = 0; l < 2 * p - 1; l++)
+        b[l] = 0;
+      for (int l = 0; l < p - 1; l++)
+        r[l] = 0;
+      for (int i = 0; i < p; i++)
+        for (int l = 0; l < p - 1; l++) {
+          const uint64 x = data[i * n + l];
+          out[i][s * n + l] = x;
+          r[l] ^= x;
+          b[i + l] ^= x;
+        }
+      for (int l = 0; l < p - 1; l++) {
+        out[p][s * n + l] = r[l];
+        out[p + 1][s * n + l] = b[l] ^ b[p - 1] ^ b[l + p];
+      }
+    }
+    return;
+  }
+
+  for (long long s = 0; s < k; s++)
+    for (int i = 0; i < p; i++)
+      memcpy(out[i] + s * n, data + (s * p + i) * n, n << 3);
+  xor_kernel.xor_gather(out[p], (const uint64 *const *)out, p, k * n);
+
+  for (long long s = 0; s < k; s++) {
+    for (int i = 0; i < p; i++)
+      col[i] = out[i] + s * n;
+    if (w == 1 && p < UNROLL_MAX_P) { // 逐字计算，不调用 XOR 内核
+      uint64 b[2 * p - 1];
+
+      for (int l = 0; l < 2 * p - 1; l++)
+        b[l] = 0;
+      for (int i = 0; i < p; i++)
+        for (int l = 0; l < p - 1; l++)
+          b[i + l] ^= col[i][l];
+      for (int l = 0; l < p - 1; l++)
+        out[p + 1][s * n + l] = b[l] ^ b[p - 1] ^ b[l + p];
+    } else
+      calc_diag_parity(out[p + 1] + s * n, col, p, w);
+  }
+}
+
+/*
+ * 以下为 RDP（Row-Diagonal Parity）的编码内核。
+ * RDP 的质数为 q = p + 1（p 为数据列数）：第 0 ... (p - 1) 列为数据，
+ * 第 p 列为行校验，这 q 列的第 i 列第 j 个元素落在第 (i + j) mod q 条
+ * 对角线上；第 p + 1 列存放第 0 ... (q - 2) 条对角线的异或和，第 q - 1 条
+ * 不存储。每列 q - 1 = p 个元素。对角线包含行校验列，不需要 EVENODD 的
+ * 调整因子 S。
+ */
+
+/**
+ * @brief 由第 0 ... p 列计算 RDP 的对角线校验（第 p + 1 列）。
+ * @param p 数据列数，p + 1 为质数
+ * @return NULL
+ */
+static void rdp_calc_diag_parity(uint64 *const *col, const int p,
+                                 const int w) {
+  const int q = p + 1;
+  uint64 *b = calc_diag_sums(col, q, w);
+  const uint64 *half[2] = {b, b + (long long)q * w};
+
+  xor_kernel.xor_gather(col[p + 1], half, 2, (long long)p * w);
+}
+
+/**
+ * @brief 计算一个 RDP 条带的两个校验列。
+ * 与 encode_stripe 相同，总是内联，元素为 8 字节且 q 较小时逐字计算。
+ * @param col 第 0 ... (p + 1) 列，每列 p 个元素
+ * @param p 数据列数，p + 1 为质数
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+rdp_encode_stripe(uint64 *const *col, const int p, const int w) {
+  const int q = p + 1;
+
+  if (w == 1 && q < UNROLL_MAX_P) { // 逐字计算，不调用 XOR 内核
+    uint64 r[p], b[2 * q - 1];
+
+    memset(b, 0, sizeof(b));
+    memcpy(r, col[0], sizeof(r));
+    memcpy(b, col[0], sizeof(r));
+    for (int i = 1; i < p; i++)
+      for (int l = 0; l < p; l++) {
+        r[l] ^= col[i][l];
+        b[i + l] ^= col[i][l];
+      }
+    for (int l = 0; l < p; l++)
+      b[p + l] ^= r[l];
+    memcpy(col[p], r, sizeof(r));
+    for (int l = 0; l < p; l++)
+      col[p + 1][l] = b[l] ^ b[l + q];
+    return;
+  }
+  xor_kernel.xor_gather(col[p], (const uint64 *const *)col, p,
+                        (long long)p * w);
+  rdp_calc_diag_parity(col, p, w);
+}
+
+/**
+ * @brief 批量编码 k 个 RDP 条带，参数和数据排列与 encode_batch 相同。
+ * @param p 数据列数，p + 1 为质数
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+rdp_encode_batch(const uint64 *data, uint64 *const *out, const long long k,
+                 const int p, const int w) {
+  const int q = p + 1;
+  const long long n = (long long)p * w;
+  uint64 *col[q + 1];
+
+  if (w == 1 && q < BATCH_FUSED_P) {
+    for (long long s = 0; s < k; s++, data += p * n) {
+      uint64 r[p], b[2 * q - 1];
+
+      for (int l = 0; l < 2 * q - 1; l++)
+        b[l] = 0;
+      for (int l = 0; l < p; l++)
+        r[l] = 0;
+      for (int i = 0; i < p; i++)
+        for (int l = 0; l < p; l++) {
+          const uint64 x = data[i * n + l];
+          out[i][s * n + l] = x;
+          r[l] ^= x;
+          b[i + l] ^= x;
+        }
+      for (int l = 0; l < p; l++) {
+        out[p][s * n + l] = r[l];
+        b[p + l] ^= r[l];
+      }
+      for (int l = 0; l < p; l++)
+        out[p + 1][s * n + l] = b[l] ^ b[l + q];
+    }
+    return;
+  }
+
+  for (long long s = 0; s < k; s++)
+    for (int i = 0; i < p; i++)
+      memcpy(out[i] + s * n, data + (s * p + i) * n, n << 3);
+  xor_kernel.xor_gather(out[p], (const uint64 *const *)out, p, k * n);
+
+  for (long long s = 0; s < k; s++) {
+    for (int i = 0; i < q + 1; i++)
+      col[i] = out[i] + s * n;
+    if (w == 1 && q < UNROLL_MAX_P) { // 逐字计算，不调用 XOR 内核
+      uint64 b[2 * q - 1];
+
+      for (int l = 0; l < 2 * q - 1; l++)
+        b[l] = 0;
+      for (int i = 0; i < q; i++)
+        for (int l = 0; l < p; l++)
+          b[i + l] ^= col[i][l];
+      for (int l = 0; l < p; l++)
+        out[p + 1][s * n + l] = b[l] ^ b[l + q];
+    } else
+      rdp_calc_diag_parity(col, p, w);
+  }
+}
+
+#endif
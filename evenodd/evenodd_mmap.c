@@ -7,6 +7,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+
+#include "evenodd_kernel.h"
 #include <fcntl.h>
 
 
@@ -255,43 +257,6 @@ void get_info(const char *file_path, long long *file_size, int *p) {
   fclose(file);
 }
 
-#define CALC_PP1(res)                                                          \
-  {                                                                            \
-    uint64 _b1[2 * p - 1];                                                     \
-    memset(_b1, 0, sizeof(_b1));                                               \
-    for (int _i = 0; _i < p; _i++)                                             \
-      for (int _j = 0; _j < p - 1; _j++)                                       \
-        _b1[_i + _j] ^= a[_i][_j];                                             \
-    for (int _i = 0; _i < p - 1; _i++)                                         \
-      res[_i] = _b1[_i] ^ _b1[p - 1] ^ _b1[_i + p];                            \
-  }
-#define CALC_DIAG(res)                                                         \
-  {                                                                            \
-    uint64 _b1[2 * p - 1];                                                     \
-    memset(_b1, 0, sizeof(_b1));                                               \
-    for (int _i = 0; _i < p; _i++)                                             \
-      for (int _j = 0; _j < p - 1; _j++)                                       \
-        _b1[_i + _j] ^= a[_i][_j];                                             \
-    for (int _i = 0; _i < p - 1; _i++)                                         \
-      res[_i] = _b1[_i] ^ _b1[_i + p];                                         \
-    res[p - 1] = _b1[p - 1];                                                   \
-  }
-#define CALC_P(res)                                                            \
-  {                                                                            \
-    memset(res, 0, sizeof(res));                                               \
-    for (int _i = 0; _i < p; _i++)                                             \
-      for (int _j = 0; _j < p - 1; _j++)                                       \
-        res[_j] ^= a[_i][_j];                                                  \
-  }
-#define CALC_I(res)                                                            \
-  {                                                                            \
-    memset(res, 0, sizeof(res));                                               \
-    for (int _i = 0; _i < p + 1; _i++)                                         \
-      if (check_disk[_i])                                                      \
-        for (int _j = 0; _j < p - 1; _j++)                                     \
-          res[_j] ^= a[_i][_j];                                                \
-  }
-
 /**
  * @brief 修复文件名为 file_name 的数据。
  * @param file_name 需要修复的文件名
@@ -328,6 +293,7 @@ bool repair_work(const char *file_name, const long long file_in_size, const int
   struct Input input[p + 2];
   struct Output output[number_erasures];
   uint64 a[p + 2][p]; // 0 ... (p + 1) 列的数据
+  uint64 *col[p + 2];
   char disk_file_name[MAX_FILE_NAME_LENGTH];
   int now_output_id = 0;
 
@@ -336,6 +302,7 @@ bool repair_work(const char *file_name, const long long file_in_size, const int
   file_out_size = (blcok_num * (p - 1) + 1) << 3;
 
   for (int i = 0; i < p + 2; i++) {
+    col[i] = a[i];
     sprintf(disk_file_name, "disk_%d/%s", i, file_name);
     if (check_disk[i]) {
       init_input(&input[i], file_in_size, disk_file_name);
@@ -364,11 +331,11 @@ bool repair_work(const char *file_name, const long long file_in_size, const int
 
     if (number_erasures == 1) { // 1 个文件损坏
       if (idx[0] == p)
-        CALC_P(a[p])
+        calc_row_parity(a[p], col, p, 1);
       else if (idx[0] == p + 1)
-        CALC_PP1(a[p + 1])
+        calc_diag_parity(a[p + 1], col, p, 1);
       else
-        CALC_I(a[idx[0]])
+        calc_single_column(a[idx[0]], col, check_disk, p, 1);
       // if (output[0].p == output[0].ed)
       //   flush_output(&output[0]);
       write_array_unsafe(&output[0], a[idx[0]], p - 1);
@@ -376,12 +343,12 @@ bool repair_work(const char *file_name, const long long file_in_size, const int
     } else { // 2 个文件损坏
       const int disk_i = idx[0], disk_j = idx[1];
       if (disk_i == p && disk_j == p + 1) { // 相当于重新加密
-        CALC_P(a[p])
-        CALC_PP1(a[p + 1])
+        calc_row_parity(a[p], col, p, 1);
+        calc_diag_parity(a[p + 1], col, p, 1);
       } else if (disk_i < p && disk_j == p) {
         uint64 S[p]; // 对角线的 xor
         uint64 t;
-        CALC_DIAG(S)
+        calc_diag_syndrome(S, col, p, 1);
 
         for (int l = 0; l < p - 1; l++)
           S[l] ^= a[p + 1][l];
@@ -389,22 +356,23 @@ bool repair_work(const char *file_name, const long long file_in_size, const int
         t = S[mod_p(disk_i - 1)];
         for (int k = 0; k < p - 1; k++)
           a[disk_i][k] = S[mod_p(disk_i + k - p)] ^ t;
-        CALC_P(a[p])
+        calc_row_parity(a[p], col, p, 1);
       } else if (disk_i < p &&
                  disk_j == p + 1) { // 由 a[p] 可以修复 disk_i 然后再求解 a[p+1]
-        CALC_I(a[disk_i])
-        CALC_PP1(a[p + 1])
+        calc_single_column(a[disk_i], col, check_disk, p, 1);
+        calc_diag_parity(a[p + 1], col, p, 1);
       } else if (disk_i < p && disk_j < p) {
         uint64 S = 0;
         uint64 S0[p], S1[p];
 
-        CALC_P(S0)
+        calc_row_parity(S0, col, p, 1);
+        S0[p - 1] = 0;
         for (int l = 0; l <= p - 1; l++) {
           S0[l] ^= a[p][l];
           S ^= a[p][l] ^ a[p + 1][l];
         }
 
-        CALC_DIAG(S1)
+        calc_diag_syndrome(S1, col, p, 1);
         for (int l = 0; l <= p - 1; l++)
           S1[l] ^= S ^ a[p + 1][l];
 
@@ -447,6 +415,10 @@ void write(const char *file_name, const int p) {
   struct Output output[p + 2];
   long long file_in_size, file_out_size;
   uint64 a[p + 2][p - 1];
+  uint64 *col[p + 2];
+
+  for (int i = 0; i < p + 2; i++)
+    col[i] = a[i];
 
   file_in_size = get_file_stat(file_name).st_size;
 
@@ -490,8 +462,8 @@ void write(const char *file_name, const int p) {
     // for (int i = 0; i < p; i++)
     // memcpy(ptr_out[i], a[i], (p - 1) << 3), ptr_out[i] += p - 1;
 
-    CALC_P(a[p])
-    CALC_PP1(a[p + 1])
+    calc_row_parity(a[p], col, p, 1);
+    calc_diag_parity(a[p + 1], col, p, 1);
     // if (output[0].p == output[0].ed)
     //   for (int i = 0; i < p + 2; i++)
     //     flush_output(&output[i]);
@@ -659,6 +631,7 @@ void usage() {
 }
 
 int main(int argc, char **argv) {
+  init_xor_kernel();
   // int id[]= {0};
   // repair(1, id);
   // return 0;
@@ -0,0 +1,304 @@
+#ifndef EVENODD_URING_H
+#define EVENODD_URING_H
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * 不依赖 liburing 的最小 io_uring 封装，供 Input / Output 的异步后端使用。
+ * 每个线程最多拥有一个 Ring（get_ring() 懒创建），一个 Ring 只能由创建它的
+ * 线程提交和等待。提交只是把 SQE 放进队列，直到有人等待完成时才用一次
+ * io_uring_enter 批量提交，因此多个列文件的读写可以同时在途。
+ */
+
+#define RING_ENTRIES 256            // 提交队列长度
+#define RING_MAX_FILES 256          // 注册文件表大小
+#define RING_ARENA_SIZE (1LL << 25) // 注册缓存区大小
+#define RING_ARENA_ALIGN 4096       // 注册缓存区内的分配对齐
+
+/**
+ * @brief 一个异步读写请求。
+ * state 为 0 表示空闲，1 表示在途，2 表示已完成（result 为返回值）。
+ */
+struct Ring_request {
+  int state;
+  int result;
+  struct Ring *ring; // 提交到的 Ring
+};
+
+struct Ring {
+  int fd;
+  void *sq_ptr, *cq_ptr, *sqes_ptr; // 用于 munmap
+  long long sq_size, cq_size, sqes_size;
+  unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+  unsigned *cq_head, *cq_tail, cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned to_submit; // 已放入队列但尚未提交的 SQE 数
+
+  char *arena; // 注册缓存区，第一次 ring_alloc 时创建
+  long long arena_used;
+  int arena_users;
+  bool fixed_buffers; // arena 是否注册成功
+
+  int files[RING_MAX_FILES]; // 注册文件表，-1 表示空位
+  bool fixed_files;          // 文件表是否注册成功
+};
+
+static __thread struct Ring *thread_ring = NULL;
+static bool ring_unavailable = false; // 内核不支持 io_uring 时为 true
+
+static void *ring_mmap(int fd, long long size, long long offset) {
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/**
+ * @brief 取得当前线程的 Ring，不存在时创建。
+ * @return 当前线程的 Ring，内核不支持 io_uring 时返回 NULL
+ */
+static struct Ring *get_ring() {
+  struct io_uring_params params;
+  struct Ring *ring;
+  char *sq, *cq;
+
+  if (thread_ring != NULL || ring_unavailable)
+    return thread_ring;
+
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (fd < 0) {
+    ring_unavailable = true;
+    return NULL;
+  }
+
+  long long sq_size = params.sq_off.array + params.sq_entries * 4LL;
+  long long cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+  sq = (char *)ring_mmap(fd, sq_size, IORING_OFF_SQ_RING);
+  cq = (params.features & IORING_FEAT_SINGLE_MMAP)
+           ? sq
+           : (char *)ring_mmap(fd, cq_size, IORING_OFF_CQ_RING);
+  ring = (struct Ring *)calloc(1, sizeof(struct Ring));
+  ring->sqes = (struct io_uring_sqe *)ring_mmap(
+      fd, params.sq_entries * sizeof(struct io_uring_sqe), IORING_OFF_SQES);
+  if (sq == NULL || cq == NULL || ring->sqes == NULL) {
+    close(fd);
+    free(ring);
+    ring_unavailable = true;
+    return NULL;
+  }
+
+  ring->fd = fd;
+  ring->sq_ptr = sq;
+  ring->sq_size = sq_size;
+  ring->cq_ptr = cq;
+  ring->cq_size = cq_size;
+  ring->sqes_ptr = ring->sqes;
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  for (int i = 0; i < RING_MAX_FILES; i++)
+    ring->files[i] = -1;
+  ring->fixed_files = syscall(__NR_io_uring_register, fd,
+                              IORING_REGISTER_FILES, ring->files,
+                              RING_MAX_FILES) == 0;
+  thread_ring = ring;
+  return ring;
+}
+
+/**
+ * @brief 调用 io_uring_enter 提交队列中的 SQE，并等待至少 min_complete
+ * 个请求完成。
+ * @return NULL
+ */
+static void ring_enter(struct Ring *ring, unsigned min_complete) {
+  int ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit,
+                    min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0,
+                    NULL, 0);
+  if (ret > 0)
+    ring->to_submit -= ret;
+}
+
+/**
+ * @brief 收取所有已完成的 CQE，并标记对应请求为已完成。
+ * @return NULL
+ */
+static void ring_reap(struct Ring *ring) {
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    struct Ring_request *req = (struct Ring_request *)cqe->user_data;
+    req->result = cqe->res;
+    req->state = 2;
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief 等待请求 req 完成。必须在提交 req 的线程中调用。
+ * @return 请求的返回值（字节数或负的错误码）
+ */
+static int ring_wait(struct Ring_request *req) {
+  while (req->state == 1) {
+    ring_reap(req->ring);
+    if (req->state == 1)
+      ring_enter(req->ring, 1);
+  }
+  req->state = 0;
+  return req->result;
+}
+
+/**
+ * @brief 把一个读 / 写请求放进当前线程 Ring 的提交队列（不立即提交）。
+ * @param ring 当前线程的 Ring
+ * @param req 请求，完成前不能被释放
+ * @param write 为 true 表示写
+ * @param fd 文件描述符
+ * @param file_index 注册文件表中的下标，-1 表示不使用
+ * @param buf 缓存区
+ * @param fixed buf 是否位于 ring 的注册缓存区内
+ * @param len 字节数
+ * @param offset 文件偏移
+ * @return NULL
+ */
+static void ring_submit(struct Ring *ring, struct Ring_request *req,
+                        bool write, int fd, int file_index, void *buf,
+                        bool fixed, unsigned len, long long offset) {
+  unsigned tail = *ring->sq_tail;
+
+  while (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) ==
+         ring->sq_entries) // 队列已满，先提交
+    ring_enter(ring, 0);
+
+  struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  if (fixed && ring->fixed_buffers) {
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = 0;
+  } else
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+  if (file_index >= 0 && ring->fixed_files) {
+    sqe->fd = file_index;
+    sqe->flags = IOSQE_FIXED_FILE;
+  } else
+    sqe->fd = fd;
+  sqe->addr = (unsigned long long)buf;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = (unsigned long long)req;
+
+  req->state = 1;
+  req->ring = ring;
+  ring->sq_array[tail & ring->sq_mask] = tail & ring->sq_mask;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->to_submit++;
+}
+
+/**
+ * @brief 在注册缓存区中申请 size 字节。
+ * 注册缓存区只做顺序分配，所有使用者都释放后整体回收。
+ * @return 申请到的地址，空间不足时返回 NULL
+ */
+static void *ring_alloc(struct Ring *ring, long long size) {
+  if (ring->arena == NULL) {
+    ring->arena = (char *)mmap(NULL, RING_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->arena == MAP_FAILED) {
+      ring->arena = NULL;
+      return NULL;
+    }
+    struct iovec iov = {ring->arena, RING_ARENA_SIZE};
+    ring->fixed_buffers = syscall(__NR_io_uring_register, ring->fd,
+                                  IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+  }
+  size = (size + RING_ARENA_ALIGN - 1) / RING_ARENA_ALIGN * RING_ARENA_ALIGN;
+  if (ring->arena_used + size > RING_ARENA_SIZE)
+    return NULL;
+  ring->arena_users++;
+  ring->arena_used += size;
+  return ring->arena + ring->arena_used - size;
+}
+
+static void ring_free(struct Ring *ring) {
+  if (--ring->arena_users == 0)
+    ring->arena_used = 0;
+}
+
+/**
+ * @brief 把 fd 放进注册文件表。
+ * @return 在注册文件表中的下标，失败时返回 -1
+ */
+static int ring_register_file(struct Ring *ring, int fd) {
+  if (!ring->fixed_files)
+    return -1;
+  for (int i = 0; i < RING_MAX_FILES; i++)
+    if (ring->files[i] == -1) {
+      struct io_uring_files_update update;
+      memset(&update, 0, sizeof(update));
+      update.offset = i;
+      update.fds = (unsigned long long)&fd;
+      if (syscall(__NR_io_uring_register, ring->fd,
+                  IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+        return -1;
+      ring->files[i] = fd;
+      return i;
+    }
+  return -1;
+}
+
+static void ring_unregister_file(struct Ring *ring, int file_index) {
+  int fd = -1;
+  struct io_uring_files_update update;
+
+  if (file_index < 0)
+    return;
+  memset(&update, 0, sizeof(update));
+  update.offset = file_index;
+  update.fds = (unsigned long long)&fd;
+  syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES_UPDATE,
+          &update, 1);
+  ring->files[file_index] = -1;
+}
+
+/**
+ * @brief 销毁当前线程的 Ring（若存在且不再被使用）。
+ * 在线程结束前调用，避免泄漏。
+ * @return NULL
+ */
+static void release_ring() {
+  struct Ring *ring = thread_ring;
+
+  if (ring == NULL || ring->arena_users > 0)
+    return;
+  if (ring->arena != NULL)
+    munmap(ring->arena, RING_ARENA_SIZE);
+  munmap(ring->sqes_ptr, ring->sqes_size);
+  if (ring->cq_ptr != ring->sq_ptr)
+    munmap(ring->cq_ptr, ring->cq_size);
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+  free(ring);
+  thread_ring = NULL;
+}
+
+#endif
@@ -0,0 +1,922 @@
+#include "libevenodd.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evenodd_kernel.h"
+
+static long long min64(long long x, long long y) { return x < y ? x : y; }
+static long long max64(long long x, long long y) { return x > y ? x : y; }
+
+#define mod_p(x) (((x) < 0) ? ((x) + p) : (x))
+
+uint64 make_header(const struct File_info *info) {
+  return (uint64)__builtin_ctz(info->w) << 56 | (uint64)info->code << 52 |
+         (uint64)info->crc << 48 | (uint64)info->file_size << 8 | info->p;
+}
+
+void parse_header(uint64 x, struct File_info *info) {
+  info->p = x & 255;
+  info->file_size = (x >> 8) & ((1ULL << 40) - 1);
+  info->crc = (x >> 48) & 1;
+  info->code = (x >> 52) & 15;
+  info->w = 1 << (x >> 56);
+}
+
+int get_prime(const struct File_info *info) {
+  return info->code == CODE_RDP ? info->p + 1 : info->p;
+}
+
+bool is_prime(int x) {
+  if (x < 2)
+    return false;
+  for (int d = 2; d * d <= x; d++)
+    if (x % d == 0)
+      return false;
+  return true;
+}
+
+
+const int CRC_BLOCK_BYTES = 1 << 16; // CRC32C 每块的目标字节数
+
+long long crc_block_stripes(const struct File_info *info) {
+  return max64(1, CRC_BLOCK_BYTES / (8LL * (get_prime(info) - 1) * info->w));
+}
+
+long long get_stripe_num(const struct File_info *info) {
+  const long long stripe_bytes =
+      8LL * info->p * (get_prime(info) - 1) * info->w;
+  return (info->file_size + stripe_bytes - 1) / stripe_bytes;
+}
+
+
+#define SYM(x, j) ((x) + (long long)(j)*w) // 列 x 的第 j 个元素
+
+/*
+ * 解码计划。解码方式只取决于编码方式、p 和损坏的列，由 make_decode_plan
+ * 生成一次：kind 给出求解损坏列的方法，rebuild_row / rebuild_diag 表示之后
+ * 是否重新计算行校验列 / 对角线校验列。DECODE_DIAG 和 DECODE_CHAIN 需要逐
+ * 元素求解，其中的模运算也预先算好，展开为 steps 中依次执行的
+ * dst = a ^ b；第 p + 2、p + 3 列表示 work 中的 S0（或 S）和 S1。
+ */
+enum {
+  DECODE_PARITY, // 只损坏校验列
+  DECODE_ROW,    // 由行（第 0 ... p 列）求出 lost 列
+  DECODE_DIAG,   // EVENODD 的数据列 lost 和行校验列：由对角线求出 lost 列
+  DECODE_CHAIN,  // 两个数据列（RDP 还包括行校验列）：沿恢复链交替求解
+};
+
+struct Decode_step {
+  short dst, dst_row, a, a_row, b, b_row; // 各元素的列号和行号
+};
+
+struct Decode_plan {
+  int kind;
+  int lost;                       // DECODE_ROW / DECODE_DIAG 时求出的列
+  bool rebuild_row, rebuild_diag; // 之后是否重新计算两个校验列
+  bool *check_disk;               // 共 p + 2 项，为 true 表示该列完好
+  int step_num;
+  struct Decode_step *steps;
+};
+
+static void add_step(struct Decode_plan *plan, int dst, int dst_row, int a,
+                     int a_row, int b, int b_row) {
+  const struct Decode_step step = {dst, dst_row, a, a_row, b, b_row};
+  plan->steps[plan->step_num++] = step;
+}
+
+/**
+ * @brief 生成解码计划，参数与 get_decode_plan 相同。
+ * @return 新分配的计划，与 steps、check_disk 位于同一块内存中
+ */
+static struct Decode_plan *make_decode_plan(const struct File_info *info,
+                                            const int *idx,
+                                            const int number_erasures) {
+  const int p = info->p, q = get_prime(info);
+  const int S0 = p + 2, S1 = p + 3; // work 中的两个伴随式
+  const int disk_i = idx[0], disk_j = number_erasures == 2 ? idx[1] : -1;
+  const long long bytes = sizeof(struct Decode_plan) +
+                          2LL * q * sizeof(struct Decode_step) + p + 2;
+  struct Decode_plan *plan = (struct Decode_plan *)calloc(1, bytes);
+
+  plan->steps = (struct Decode_step *)(plan + 1);
+  plan->check_disk = (bool *)(plan->steps + 2 * q);
+  for (int i = 0; i < p + 2; i++)
+    plan->check_disk[i] = i != disk_i && i != disk_j;
+  plan->lost = disk_i;
+  plan->rebuild_diag = disk_i == p + 1 || disk_j == p + 1;
+
+  if (info->code == CODE_RDP) {
+    plan->kind = disk_i == p + 1 ? DECODE_PARITY
+                 : disk_j < 0 || disk_j == p + 1 ? DECODE_ROW
+                                                 : DECODE_CHAIN;
+    for (int c = 0; plan->kind == DECODE_CHAIN && c < 2; c++) {
+      // 对角线 x - 1 经过 x 列的虚拟元素，只含 y 列的一个未知元素，
+      // 每条链在不存储的第 q - 1 条对角线处结束
+      const int x = c == 0 ? disk_j : disk_i, y = c == 0 ? disk_i : disk_j;
+      for (int d = x == 0 ? q - 1 : x - 1, r; d != q - 1; d = (r + x) % q) {
+        r = (d - y + q) % q;
+        add_step(plan, y, r, S1, d, x, (d - x + q) % q);
+        add_step(plan, x, r, S0, r, y, r);
+      }
+    }
+    return plan;
+  }
+
+  plan->rebuild_row = disk_i == p || disk_j == p;
+  if (disk_i >= p)
+    plan->kind = DECODE_PARITY;
+  else if (disk_j < 0 || disk_j == p + 1)
+    plan->kind = DECODE_ROW;
+  else if (disk_j == p) {
+    plan->kind = DECODE_DIAG;
+    for (int k = 0; k < p - 1; k++)
+      add_step(plan, disk_i, k, S0, mod_p(disk_i + k - p), S0,
+               mod_p(disk_i - 1));
+  } else {
+    const int ij = mod_p(disk_i - disk_j), ji = mod_p(disk_j - disk_i);
+    int s = mod_p(ij - 1);
+
+    plan->kind = DECODE_CHAIN;
+    do {
+      add_step(plan, disk_j, s, S1, mod_p(disk_j + s - p), disk_i,
+               mod_p(s - ij));
+      add_step(plan, disk_i, s, S0, s, disk_j, s);
+      s = mod_p(s - ji);
+    } while (s != p - 1);
+  }
+  return plan;
+}
+
+/*
+ * 已生成的解码计划：plan_tables[code][p] 为 (p + 2)^2 项的表，按损坏列
+ * (idx[0], idx[1]) 索引（只损坏一列时为 (idx[0], idx[0])）。表和计划在第一
+ * 次用到时生成，之后只读，多个线程同时生成时只保留先放入的一个；它们一直
+ * 保留到进程结束。
+ */
+static _Atomic(_Atomic(struct Decode_plan *) *) plan_tables[2][256];
+
+const struct Decode_plan *get_decode_plan(const struct File_info *info,
+                                          const int *idx,
+                                          const int number_erasures) {
+  _Atomic(struct Decode_plan *) *table, *fresh_table;
+  struct Decode_plan *plan, *fresh;
+  const int cols = info->p + 2;
+  const int key = idx[0] * cols + (number_erasures == 2 ? idx[1] : idx[0]);
+
+  table = atomic_load_explicit(&plan_tables[info->code][info->p],
+                               memory_order_acquire);
+  if (table == NULL) {
+    fresh_table = calloc((long long)cols * cols, sizeof(*fresh_table));
+    if (atomic_compare_exchange_strong(&plan_tables[info->code][info->p],
+                                       &table, fresh_table))
+      table = fresh_table;
+    else
+      free(fresh_table);
+  }
+  plan = atomic_load_explicit(&table[key], memory_order_acquire);
+  if (plan == NULL) {
+    fresh = make_decode_plan(info, idx, number_erasures);
+    if (atomic_compare_exchange_strong(&table[key], &plan, fresh))
+      plan = fresh;
+    else
+      free(fresh);
+  }
+  return plan;
+}
+
+/**
+ * @brief 依次执行计划中的 dst = a ^ b。
+ * @param base 第 0 ... (p + 3) 列，第 p + 2、p + 3 列为 S0、S1
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+run_decode_steps(const struct Decode_plan *plan, uint64 *const *base,
+                 const int w) {
+  const struct Decode_step *st = plan->steps, *ed = st + plan->step_num;
+
+  for (; st < ed; st++)
+    xor_pair(SYM(base[st->dst], st->dst_row), SYM(base[st->a], st->a_row),
+             SYM(base[st->b], st->b_row), w);
+}
+
+/**
+ * @brief decode_stripe 在每个元素只有一个 uint64 时的逐字版本，
+ * 不调用 XOR 内核。参数含义与 decode_stripe 相同。
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+decode_stripe_word(uint64 *const *col, const struct Decode_plan *plan,
+                   const int p) {
+  const int disk_i = plan->lost, w = 1;
+  uint64 r[p], b[2 * p]; // 第 0 ... (p - 1) 列的行异或和、各对角线异或和
+  uint64 S0[p], S1[p], *base[p + 4];
+
+  memcpy(r, col[0], sizeof(r));
+  memset(b, 0, sizeof(b));
+  memcpy(b, col[0], sizeof(r));
+  for (int i = 1; i < p; i++)
+    for (int l = 0; l < p; l++) {
+      r[l] ^= col[i][l];
+      b[i + l] ^= col[i][l];
+    }
+  memcpy(base, col, (p + 2) * sizeof(uint64 *));
+  base[p + 2] = S0;
+  base[p + 3] = S1;
+
+  if (plan->kind == DECODE_ROW) { // 由行校验修复 disk_i
+    for (int l = 0; l < p - 1; l++) {
+      col[disk_i][l] = r[l] ^ col[p][l];
+      b[disk_i + l] ^= col[disk_i][l];
+    }
+  } else if (plan->kind == DECODE_DIAG) { // 由对角线校验修复 disk_i
+    for (int l = 0; l < p; l++)
+      S0[l] = b[l] ^ b[l + p] ^ col[p + 1][l];
+    run_decode_steps(plan, base, w);
+    for (int k = 0; k < p - 1; k++)
+      r[k] ^= col[disk_i][k];
+  } else if (plan->kind == DECODE_CHAIN) { // 两个数据列
+    uint64 adjuster = 0;
+    for (int l = 0; l < p - 1; l++)
+      adjuster ^= col[p][l] ^ col[p + 1][l];
+    for (int l = 0; l < p; l++) {
+      S0[l] = r[l] ^ col[p][l];
+      S1[l] = b[l] ^ b[l + p] ^ col[p + 1][l] ^ adjuster;
+    }
+    run_decode_steps(plan, base, w);
+    return;
+  }
+
+  if (plan->rebuild_row)
+    memcpy(col[p], r, (p - 1) << 3);
+  if (plan->rebuild_diag)
+    for (int l = 0; l < p - 1; l++)
+      col[p + 1][l] = b[l] ^ b[p - 1] ^ b[l + p];
+}
+
+/**
+ * @brief 解码一个条带：由完好的列求出损坏的（至多 2）列。
+ * col[i] 为第 i 列，长度为 p 个元素，其中第 p - 1 个元素（虚拟的全零行）
+ * 必须为 0；损坏的列需要预先清零。
+ * 总是内联，供下面按质数特化的编解码函数使用。
+ * @param col 第 0 ... (p + 1) 列
+ * @param plan 损坏列对应的解码计划（见 get_decode_plan）
+ * @param work 临时空间，长度至少为 (2p + 1) 个元素
+ * @param p 质数 p
+ * @param w 每个元素包含的 uint64 个数
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+decode_stripe(uint64 *const *col, const struct Decode_plan *plan,
+              uint64 *work, const int p, const int w) {
+  const long long n = (long long)(p - 1) * w;
+  uint64 *base[p + 4];
+
+  if (w == 1 && p < UNROLL_MAX_P) {
+    decode_stripe_word(col, plan, p);
+    return;
+  }
+  memcpy(base, col, (p + 2) * sizeof(uint64 *));
+  base[p + 2] = work;
+  base[p + 3] = SYM(work, p);
+
+  if (plan->kind == DECODE_ROW)
+    calc_single_column(col[plan->lost], col, plan->check_disk, p, w);
+  else if (plan->kind == DECODE_DIAG) {
+    uint64 *S = work; // 对角线的 xor
+    calc_diag_syndrome(S, col, p, w);
+    xor_kernel.xor_into(S, col[p + 1], n);
+    run_decode_steps(plan, base, w);
+  } else if (plan->kind == DECODE_CHAIN) {
+    uint64 *S0 = work, *S1 = SYM(work, p), *S = SYM(work, 2 * p);
+
+    calc_row_parity(S0, col, p, w);
+    memset(SYM(S0, p - 1), 0, (long long)w << 3);
+    xor_kernel.xor_into(S0, col[p], n);
+
+    memset(S, 0, (long long)w << 3);
+    for (int l = 0; l < p - 1; l++) {
+      xor_kernel.xor_into(S, SYM(col[p], l), w);
+      xor_kernel.xor_into(S, SYM(col[p + 1], l), w);
+    }
+
+    calc_diag_syndrome(S1, col, p, w);
+    xor_kernel.xor_into(S1, col[p + 1], n);
+    for (int l = 0; l <= p - 1; l++)
+      xor_kernel.xor_into(SYM(S1, l), S, w);
+    run_decode_steps(plan, base, w);
+    return;
+  }
+
+  if (plan->rebuild_row)
+    calc_row_parity(col[p], col, p, w);
+  if (plan->rebuild_diag)
+    calc_diag_parity(col[p + 1], col, p, w);
+}
+
+/**
+ * @brief 解码一个 RDP 条带：由完好的列求出损坏的（至多 2）列。
+ * 参数含义与 decode_stripe 相同，p 为数据列数，q = p + 1 为质数；每列 q 个
+ * 元素，最后一个为 0。
+ * 两个损坏列都在第 0 ... p 列中时，先求出行异或和 S0 与对角线异或和 S1，
+ * 再按计划从两列各自虚拟元素所在的对角线出发交替使用对角线和行求解。
+ * @return NULL
+ */
+static inline __attribute__((always_inline)) void
+rdp_decode_stripe(uint64 *const *col, const struct Decode_plan *plan,
+                  uint64 *work, const int p, const int w) {
+  const int q = p + 1;
+  const long long n = (long long)p * w;
+  const uint64 *src[p + 2];
+  uint64 *base[p + 4];
+
+  if (plan->kind == DECODE_ROW) {
+    // 第 0 ... p 列每行的异或和为 0，由其余列求出 lost 列
+    int m = 0;
+
+    for (int i = 0; i <= p; i++)
+      if (i != plan->lost)
+        src[m++] = col[i];
+    xor_kernel.xor_gather(col[plan->lost], src, m, n);
+  } else if (plan->kind == DECODE_CHAIN) {
+    const uint64 *b = calc_diag_sums(col, q, w); // 损坏的列为 0
+
+    memcpy(base, col, (p + 2) * sizeof(uint64 *));
+    base[p + 2] = work;
+    base[p + 3] = SYM(work, q);
+    src[0] = b;
+    src[1] = b + (long long)q * w;
+    src[2] = col[p + 1];
+    xor_kernel.xor_gather(work, (const uint64 *const *)col, q, n);
+    xor_kernel.xor_gather(SYM(work, q), src, 3, n);
+    run_decode_steps(plan, base, w);
+    return;
+  }
+  if (plan->rebuild_diag)
+    rdp_calc_diag_parity(col, p, w);
+}
+
+/*
+ * 按质数特化的编解码函数。
+ * CODEC_DEFINE(P) 以常量 P 内联 encode_stripe / decode_stripe，编译器可以
+ * 展开以 p 为边界的循环，并把 mod_p 的下标运算常量折叠。
+ * 函数签名与 struct Codec 相同，参数 p 只为与通用版本一致，不使用。
+ * 每个文件只在开始时用 get_codec(info) 查一次表；表中没有的 p 使用通用版本。
+ */
+#define CODEC_DEFINE(P)                                                        \
+  static void encode_stripe_##P(uint64 *const *col, const int p,               \
+                                const int w) {                                 \
+    (void)p;                                                                   \
+    encode_stripe(col, P, w);                                                  \
+  }                                                                            \
+  static void encode_batch_##P(const uint64 *data, uint64 *const *out,         \
+                               const long long k, const int p, const int w) {  \
+    (void)p;                                                                   \
+    encode_batch(data, out, k, P, w);                                          \
+  }                                                                            \
+  static void decode_stripe_##P(uint64 *const *col,                           \
+                                const struct Decode_plan *plan, uint64 *work,  \
+                                const int p, const int w) {                    \
+    (void)p;                                                                   \
+    decode_stripe(col, plan, work, P, w);                                      \
+  }
+
+CODEC_DEFINE(3)
+CODEC_DEFINE(5)
+CODEC_DEFINE(7)
+CODEC_DEFINE(11)
+CODEC_DEFINE(13)
+CODEC_DEFINE(17)
+CODEC_DEFINE(19)
+CODEC_DEFINE(23)
+CODEC_DEFINE(29)
+CODEC_DEFINE(31)
+CODEC_DEFINE(37)
+CODEC_DEFINE(41)
+CODEC_DEFINE(43)
+CODEC_DEFINE(47)
+CODEC_DEFINE(53)
+CODEC_DEFINE(59)
+CODEC_DEFINE(61)
+CODEC_DEFINE(67)
+CODEC_DEFINE(71)
+CODEC_DEFINE(73)
+CODEC_DEFINE(79)
+CODEC_DEFINE(83)
+CODEC_DEFINE(89)
+CODEC_DEFINE(97)
+
+static void encode_stripe_generic(uint64 *const *col, const int p,
+                                  const int w) {
+  encode_stripe(col, p, w);
+}
+static void encode_batch_generic(const uint64 *data, uint64 *const *out,
+                                 const long long k, const int p,
+                                 const int w) {
+  encode_batch(data, out, k, p, w);
+}
+static void decode_stripe_generic(uint64 *const *col,
+                                  const struct Decode_plan *plan, uint64 *work,
+                                  const int p, const int w) {
+  decode_stripe(col, plan, work, p, w);
+}
+
+/*
+ * RDP 的特化版本。RDP_CODEC_DEFINE(Q) 以常量 p = Q - 1 内联 RDP 的编解码
+ * 函数，表按数据列数 Q - 1 索引。参数 p 同样不使用。
+ */
+#define RDP_CODEC_DEFINE(Q)                                                    \
+  static void rdp_encode_stripe_##Q(uint64 *const *col, const int p,           \
+                                    const int w) {                             \
+    (void)p;                                                                   \
+    rdp_encode_stripe(col, Q - 1, w);                                          \
+  }                                                                            \
+  static void rdp_encode_batch_##Q(const uint64 *data, uint64 *const *out,     \
+                                   const long long k, const int p,             \
+                                   const int w) {                              \
+    (void)p;                                                                   \
+    rdp_encode_batch(data, out, k, Q - 1, w);                                  \
+  }                                                                            \
+  static void rdp_decode_stripe_##Q(uint64 *const *col,                       \
+                                    const struct Decode_plan *plan,            \
+                                    uint64 *work, const int p, const int w) {  \
+    (void)p;                                                                   \
+    rdp_decode_stripe(col, plan, work, Q - 1, w);                              \
+  }
+
+RDP_CODEC_DEFINE(5)
+RDP_CODEC_DEFINE(7)
+RDP_CODEC_DEFINE(11)
+RDP_CODEC_DEFINE(13)
+RDP_CODEC_DEFINE(17)
+RDP_CODEC_DEFINE(19)
+RDP_CODEC_DEFINE(23)
+RDP_CODEC_DEFINE(29)
+RDP_CODEC_DEFINE(31)
+RDP_CODEC_DEFINE(37)
+RDP_CODEC_DEFINE(41)
+RDP_CODEC_DEFINE(43)
+RDP_CODEC_DEFINE(47)
+RDP_CODEC_DEFINE(53)
+RDP_CODEC_DEFINE(59)
+RDP_CODEC_DEFINE(61)
+RDP_CODEC_DEFINE(67)
+RDP_CODEC_DEFINE(71)
+RDP_CODEC_DEFINE(73)
+RDP_CODEC_DEFINE(79)
+RDP_CODEC_DEFINE(83)
+RDP_CODEC_DEFINE(89)
+RDP_CODEC_DEFINE(97)
+
+static void rdp_encode_stripe_generic(uint64 *const *col, const int p,
+                                      const int w) {
+  rdp_encode_stripe(col, p, w);
+}
+static void rdp_encode_batch_generic(const uint64 *data, uint64 *const *out,
+                                     const long long k, const int p,
+                                     const int w) {
+  rdp_encode_batch(data, out, k, p, w);
+}
+static void rdp_decode_stripe_generic(uint64 *const *col,
+                                      const struct Decode_plan *plan,
+                                      uint64 *work, const int p, const int w) {
+  rdp_decode_stripe(col, plan, work, p, w);
+}
+
+#define CODEC_ENTRY(P)                                                         \
+  [P] = {encode_stripe_##P, encode_batch_##P, decode_stripe_##P}
+
+static const struct Codec CODECS[] = {
+    CODEC_ENTRY(3),  CODEC_ENTRY(5),  CODEC_ENTRY(7),  CODEC_ENTRY(11),
+    CODEC_ENTRY(13), CODEC_ENTRY(17), CODEC_ENTRY(19), CODEC_ENTRY(23),
+    CODEC_ENTRY(29), CODEC_ENTRY(31), CODEC_ENTRY(37), CODEC_ENTRY(41),
+    CODEC_ENTRY(43), CODEC_ENTRY(47), CODEC_ENTRY(53), CODEC_ENTRY(59),
+    CODEC_ENTRY(61), CODEC_ENTRY(67), CODEC_ENTRY(71), CODEC_ENTRY(73),
+    CODEC_ENTRY(79), CODEC_ENTRY(83), CODEC_ENTRY(89), CODEC_ENTRY(97),
+};
+static const int CODEC_NUM = sizeof(CODECS) / sizeof(CODECS[0]);
+
+#define RDP_CODEC_ENTRY(Q)                                                     \
+  [Q - 1] = {rdp_encode_stripe_##Q, rdp_encode_batch_##Q, rdp_decode_stripe_##Q}
+
+static const struct Codec RDP_CODECS[] = {
+    RDP_CODEC_ENTRY(5),  RDP_CODEC_ENTRY(7),  RDP_CODEC_ENTRY(11),
+    RDP_CODEC_ENTRY(13), RDP_CODEC_ENTRY(17), RDP_CODEC_ENTRY(19),
+    RDP_CODEC_ENTRY(23), RDP_CODEC_ENTRY(29), RDP_CODEC_ENTRY(31),
+    RDP_CODEC_ENTRY(37), RDP_CODEC_ENTRY(41), RDP_CODEC_ENTRY(43),
+    RDP_CODEC_ENTRY(47), RDP_CODEC_ENTRY(53), RDP_CODEC_ENTRY(59),
+    RDP_CODEC_ENTRY(61), RDP_CODEC_ENTRY(67), RDP_CODEC_ENTRY(71),
+    RDP_CODEC_ENTRY(73), RDP_CODEC_ENTRY(79), RDP_CODEC_ENTRY(83),
+    RDP_CODEC_ENTRY(89), RDP_CODEC_ENTRY(97),
+};
+static const int RDP_CODEC_NUM = sizeof(RDP_CODECS) / sizeof(RDP_CODECS[0]);
+
+/**
+ * @brief 取得文件的编码方式和数据列数对应的编解码函数。
+ * @return 特化版本，表中没有时为通用版本
+ */
+struct Codec get_codec(const struct File_info *info) {
+  const struct Codec generic = {encode_stripe_generic, encode_batch_generic,
+                                decode_stripe_generic};
+  const struct Codec rdp_generic = {rdp_encode_stripe_generic,
+                                    rdp_encode_batch_generic,
+                                    rdp_decode_stripe_generic};
+  const int p = info->p;
+
+  if (info->code == CODE_RDP)
+    return p < RDP_CODEC_NUM && RDP_CODECS[p].encode != NULL ? RDP_CODECS[p]
+                                                             : rdp_generic;
+  if (p < CODEC_NUM && CODECS[p].encode != NULL)
+    return CODECS[p];
+  return generic;
+}
+
+/*
+ * 单个数据列损坏时的混合修复。
+ * 记 q = get_prime(info)，每列 q - 1 行。第 lost 列第 r 行的元素既可以由第
+ * r 行（其余列与行校验）求出，也可以由它所在的第 (r + lost) mod q 条对角线
+ * 求出。前一半行按行、后一半行按对角线修复时，对角线经过的元素大多落在已
+ * 读入的前一半行中，需要读入的元素约为全部的 3/4。
+ * 第 lost 列在第 q - 1 条对角线（EVENODD 的调整因子所在的对角线，RDP 不
+ * 存储的对角线）上的元素只能按行修复，这一行不在前一半中时换掉第 0 行。
+ */
+
+int plan_hybrid_repair(const struct File_info *info, const int lost,
+                       bool *by_row, bool *need) {
+  const int p = info->p, q = get_prime(info), rows = q - 1;
+  const int diag_cols = info->code == CODE_RDP ? p + 1 : p; // 参与对角线的列
+  const int special = q - 1 - lost; // 第 lost 列在第 q - 1 条对角线上的行
+  int count = 0;
+
+  for (int r = 0; r < rows; r++)
+    by_row[r] = r < rows / 2;
+  if (special < rows && !by_row[special]) {
+    by_row[0] = false;
+    by_row[special] = true;
+  }
+
+  memset(need, 0, (p + 2) * rows * sizeof(bool));
+  for (int r = 0; r < rows; r++) {
+    if (by_row[r]) {
+      for (int i = 0; i <= p; i++)
+        need[i * rows + r] |= i != lost;
+      continue;
+    }
+    const int d = (r + lost) % q;
+    for (int i = 0; i < diag_cols; i++) {
+      const int j = (d - i + q) % q;
+      need[i * rows + j] |= i != lost && j < rows;
+    }
+    need[(p + 1) * rows + d] = true;
+  }
+  if (info->code == CODE_EVENODD) // 调整因子 S 为第 p - 1 条对角线的异或和
+    for (int i = 1; i < p; i++)
+      need[i * rows + p - 1 - i] |= i != lost;
+
+  for (int k = 0; k < (p + 2) * rows; k++)
+    count += need[k];
+  return count;
+}
+
+void decode_hybrid(const struct File_info *info, uint64 *const *col,
+                   const int lost, const bool *by_row) {
+  const int p = info->p, q = get_prime(info), rows = q - 1, w = info->w;
+  const int diag_cols = info->code == CODE_RDP ? p + 1 : p;
+  const uint64 *src[p + 2];
+  uint64 *S = NULL;
+  int m;
+
+  for (int r = 0; r < rows; r++) {
+    if (!by_row[r])
+      continue;
+    m = 0;
+    for (int i = 0; i <= p; i++)
+      if (i != lost)
+        src[m++] = SYM(col[i], r);
+    xor_kernel.xor_gather(SYM(col[lost], r), src, m, w);
+  }
+
+  if (info->code == CODE_EVENODD) { // 第 lost 列在该对角线上的元素已求出
+    S = get_scratch(w);
+    m = 0;
+    for (int i = 1; i < p; i++)
+      src[m++] = SYM(col[i], p - 1 - i);
+    xor_kernel.xor_gather(S, src, m, w);
+  }
+
+  for (int r = 0; r < rows; r++) {
+    if (by_row[r])
+      continue;
+    const int d = (r + lost) % q;
+    m = 0;
+    src[m++] = SYM(col[p + 1], d);
+    if (S != NULL)
+      src[m++] = S;
+    for (int i = 0; i < diag_cols; i++) {
+      const int j = (d - i + q) % q;
+      if (i != lost && j < rows)
+        src[m++] = SYM(col[i], j);
+    }
+    xor_kernel.xor_gather(SYM(col[lost], r), src, m, w);
+  }
+}
+
+void evenodd_init() {
+  init_xor_kernel();
+  init_crc32c();
+}
+
+void evenodd_xor_into(uint64 *dst, const uint64 *src, long long n) {
+  xor_kernel.xor_into(dst, src, n);
+}
+
+unsigned evenodd_crc32c(unsigned crc, const void *buf, long long len) {
+  return crc32c(crc, buf, len);
+}
+
+
+const int STREAM_BATCH_BYTES = 1 << 17; // 编码器 / 解码器每批的字节数
+
+/*
+ * 编码器依次处理调用者写入的数据：凑满的条带直接从调用者的缓存区按批
+ * 编码，跨越两次写入的条带先复制到 stage。每批编码到 sink 提供的缓存区
+ * （没有时为 columns）后，各列依次交给 sink。第一批之前写出各列的文件头，
+ * finish 时写出 CRC32C 文件尾。
+ */
+struct Evenodd_encoder {
+  struct File_info info;
+  struct Codec codec;
+  struct Evenodd_sink sink;
+  int n;                  // 每个条带中每列的 uint64 个数
+  long long stripe_bytes; // 每个条带的数据字节数
+  long long batch;        // 每批的条带数
+  uint64 *columns;        // 编码后的 p + 2 列，每列 batch * n 个
+  uint64 *stage;          // 暂存一个不完整的条带
+  long long staged;       // stage 中的字节数
+  long long received;     // 已写入的字节数
+  long long stripes;      // 已编码的条带数
+  unsigned *crc;          // 各列各块的 CRC32C，每列 block_num 个
+  long long block_num;    // 每列的 CRC32C 块数
+  bool started;           // 是否已写出文件头
+  bool failed;            // sink 是否出错
+};
+
+/**
+ * @brief 文件头信息 info 能否用于编解码：编码方式已知，元素为 2 的幂个
+ * uint64，数据列数放得进文件头（EVENODD 至少 3 列，RDP 至少 4 列），
+ * 且 get_prime(info) 为质数，否则两列损坏时无法正确恢复。
+ */
+static bool valid_info(const struct File_info *info) {
+  if (info->code != CODE_EVENODD && info->code != CODE_RDP)
+    return false;
+  return info->p >= (info->code == CODE_RDP ? 4 : 3) && info->p <= 255 &&
+         info->w >= 1 && (info->w & (info->w - 1)) == 0 &&
+         is_prime(get_prime(info));
+}
+
+struct Evenodd_encoder *evenodd_encoder_new(const struct File_info *info,
+                                            struct Evenodd_sink sink) {
+  struct Evenodd_encoder *encoder;
+  const int p = info->p;
+
+  if (!valid_info(info) || info->file_size < 0 ||
+      info->file_size >= 1LL << 40)
+    return NULL;
+  encoder = (struct Evenodd_encoder *)calloc(1, sizeof(*encoder));
+  encoder->info = *info;
+  encoder->codec = get_codec(info);
+  encoder->sink = sink;
+  encoder->n = (get_prime(info) - 1) * info->w;
+  encoder->stripe_bytes = 8LL * p * encoder->n;
+  encoder->batch = max64(1, STREAM_BATCH_BYTES / encoder->stripe_bytes);
+  encoder->columns =
+      (uint64 *)malloc(8LL * encoder->batch * (p + 2) * encoder->n);
+  encoder->stage = (uint64 *)malloc(encoder->stripe_bytes);
+  if (info->crc) {
+    const long long block = crc_block_stripes(info);
+    encoder->block_num = (get_stripe_num(info) + block - 1) / block;
+    encoder->crc = (unsigned *)calloc(max64(1, encoder->block_num * (p + 2)),
+                                      sizeof(unsigned));
+  }
+  return encoder;
+}
+
+static void encoder_emit(struct Evenodd_encoder *encoder, int column,
+                         const void *data, long long len) {
+  if (!encoder->failed && len > 0)
+    encoder->failed =
+        !encoder->sink.write(encoder->sink.arg, column, data, len);
+}
+
+static void encoder_start(struct Evenodd_encoder *encoder) {
+  const uint64 header = make_header(&encoder->info);
+
+  if (encoder->started)
+    return;
+  for (int i = 0; i < encoder->info.p + 2; i++)
+    encoder_emit(encoder, i, &header, 8);
+  encoder->started = true;
+}
+
+/**
+ * @brief 编码 data 中的 k 个完整条带并交给 sink。
+ * @return NULL
+ */
+static void encoder_encode(struct Evenodd_encoder *encoder, const uint64 *data,
+                           long long k) {
+  const int p = encoder->info.p, n = encoder->n;
+  const long long block = crc_block_stripes(&encoder->info);
+  uint64 *out[p + 2];
+
+  encoder_start(encoder);
+  for (int i = 0; i < p + 2; i++) {
+    out[i] = encoder->sink.reserve == NULL || encoder->failed
+                 ? NULL
+                 : (uint64 *)encoder->sink.reserve(encoder->sink.arg, i,
+                                                   k * n * 8);
+    if (out[i] == NULL)
+      out[i] = encoder->columns + (long long)i * encoder->batch * n;
+  }
+  encoder->codec.encode_batch(data, out, k, p, encoder->info.w);
+  for (int i = 0; i < p + 2; i++) {
+    if (encoder->info.crc) // 按块累加 CRC32C，一批可能跨越多个块
+      for (long long t = encoder->stripes, ed; t < encoder->stripes + k;
+           t = ed) {
+        unsigned *crc = &encoder->crc[i * encoder->block_num + t / block];
+        ed = min64(encoder->stripes + k, (t / block + 1) * block);
+        *crc = crc32c(*crc, out[i] + (t - encoder->stripes) * n,
+                      (ed - t) * n * 8);
+      }
+    encoder_emit(encoder, i, out[i], k * n * 8);
+  }
+  encoder->stripes += k;
+}
+
+bool evenodd_encoder_write(struct Evenodd_encoder *encoder, const void *data,
+                           long long len) {
+  const char *src = (const char *)data;
+  const long long stripe_bytes = encoder->stripe_bytes;
+
+  if (encoder->received + len > encoder->info.file_size)
+    return false;
+  encoder->received += len;
+  if (encoder->staged > 0) { // 先补全暂存的条带
+    const long long m = min64(len, stripe_bytes - encoder->staged);
+    memcpy((char *)encoder->stage + encoder->staged, src, m);
+    encoder->staged += m;
+    src += m;
+    len -= m;
+    if (encoder->staged == stripe_bytes) {
+      encoder_encode(encoder, encoder->stage, 1);
+      encoder->staged = 0;
+    }
+  }
+  while (len >= stripe_bytes) { // 完整的条带不经复制直接编码
+    const long long k = min64(encoder->batch, len / stripe_bytes);
+    encoder_encode(encoder, (const uint64 *)src, k);
+    src += k * stripe_bytes;
+    len -= k * stripe_bytes;
+  }
+  if (len > 0) {
+    memcpy(encoder->stage, src, len);
+    encoder->staged = len;
+  }
+  return !encoder->failed;
+}
+
+bool evenodd_encoder_finish(struct Evenodd_encoder *encoder) {
+  if (encoder->received != encoder->info.file_size)
+    return false;
+  encoder_start(encoder);
+  if (encoder->staged > 0) { // 最后一个条带补零
+    memset((char *)encoder->stage + encoder->staged, 0,
+           encoder->stripe_bytes - encoder->staged);
+    encoder_encode(encoder, encoder->stage, 1);
+    encoder->staged = 0;
+  }
+  if (encoder->info.crc)
+    for (int i = 0; i < encoder->info.p + 2; i++)
+      encoder_emit(encoder, i, encoder->crc + i * encoder->block_num,
+                   encoder->block_num * 4);
+  return !encoder->failed;
+}
+
+void evenodd_encoder_free(struct Evenodd_encoder *encoder) {
+  if (encoder == NULL)
+    return;
+  free(encoder->columns);
+  free(encoder->stage);
+  free(encoder->crc);
+  free(encoder);
+}
+
+/*
+ * 解码器逐批处理调用者给出的各列数据：缺失数据列时，逐条带把完好的列
+ * 复制到 stripe（decode 要求每列有 q 个元素，最后一个为 0）并恢复缺失的
+ * 列。各条带的 p 个数据列复制到 data 后一次交给 sink。只缺失校验列时
+ * 不需要解码。
+ */
+struct Evenodd_decoder {
+  struct File_info info;
+  struct Codec codec;
+  struct Evenodd_sink sink;
+  int n;                  // 每个条带中每列的 uint64 个数
+  long long stripe_bytes; // 每个条带的数据字节数
+  long long batch;        // 每批的条带数
+  bool check_disk[258];   // 第 i 列是否完好
+  bool lost_data;         // 是否缺失数据列
+  uint64 *stripe;         // 正在解码的条带，p + 2 列，每列 q 个元素
+  uint64 *work;           // decode 的临时空间
+  uint64 *data;           // 解出的一批原文件数据
+  long long emitted;      // 已交给 sink 的字节数
+  bool failed;            // sink 是否出错
+  // 缺失数据列时的解码计划（见 get_decode_plan）
+  const struct Decode_plan *plan;
+};
+
+struct Evenodd_decoder *evenodd_decoder_new(const struct File_info *info,
+                                            const bool *lost,
+                                            struct Evenodd_sink sink) {
+  struct Evenodd_decoder *decoder;
+  const int p = info->p, q = get_prime(info);
+  int number_erasures = 0, idx[2], m = 0;
+
+  if (!valid_info(info))
+    return NULL;
+  for (int i = 0; lost != NULL && i < p + 2; i++)
+    number_erasures += lost[i];
+  if (number_erasures > 2)
+    return NULL;
+
+  decoder = (struct Evenodd_decoder *)calloc(1, sizeof(*decoder));
+  decoder->info = *info;
+  decoder->codec = get_codec(info);
+  decoder->sink = sink;
+  decoder->n = (q - 1) * info->w;
+  decoder->stripe_bytes = 8LL * p * decoder->n;
+  decoder->batch = max64(1, STREAM_BATCH_BYTES / decoder->stripe_bytes);
+  for (int i = 0; i < p + 2; i++) {
+    decoder->check_disk[i] = lost == NULL || !lost[i];
+    if (!decoder->check_disk[i]) {
+      idx[m++] = i;
+      decoder->lost_data |= i < p;
+    }
+  }
+  if (decoder->lost_data) // 对角线校验列不必恢复
+    decoder->plan =
+        get_decode_plan(info, idx, m == 2 && idx[1] < p + 1 ? 2 : 1);
+  decoder->stripe = (uint64 *)calloc((long long)(p + 2) * q * info->w, 8);
+  decoder->work = (uint64 *)malloc(8LL * (2 * q + 1) * info->w);
+  decoder->data = (uint64 *)malloc(decoder->batch * decoder->stripe_bytes);
+  return decoder;
+}
+
+bool evenodd_decoder_write(struct Evenodd_decoder *decoder,
+                           const uint64 *const *columns, long long stripes) {
+  const int p = decoder->info.p, n = decoder->n;
+  uint64 *col[p + 2];
+
+  for (long long t = 0; t < stripes && !decoder->failed;
+       t += decoder->batch) {
+    const long long k = min64(decoder->batch, stripes - t);
+    const long long len =
+        min64(k * decoder->stripe_bytes,
+              decoder->info.file_size - decoder->emitted);
+
+    for (long long s = 0; s < k; s++) {
+      for (int i = 0; i < p + 2; i++)
+        col[i] = (uint64 *)columns[i] + (t + s) * n;
+      if (decoder->lost_data) {
+        for (int i = 0; i < p + 2; i++) {
+          uint64 *dst = decoder->stripe + (long long)i * (n + decoder->info.w);
+          if (decoder->check_disk[i])
+            memcpy(dst, col[i], 8LL * n);
+          else
+            memset(dst, 0, 8LL * n);
+          memset(dst + n, 0, 8LL * decoder->info.w);
+          col[i] = dst;
+        }
+        decoder->codec.decode(col, decoder->plan, decoder->work, p,
+                              decoder->info.w);
+      }
+      for (int i = 0; i < p; i++)
+        memcpy(decoder->data + (s * p + i) * n, col[i], 8LL * n);
+    }
+    if (len <= 0)
+      break;
+    decoder->failed =
+        !decoder->sink.write(decoder->sink.arg, -1, decoder->data, len);
+    decoder->emitted += len;
+  }
+  return !decoder->failed;
+}
+
+void evenodd_decoder_free(struct Evenodd_decoder *decoder) {
+  if (decoder == NULL)
+    return;
+  free(decoder->stripe);
+  free(decoder->work);
+  free(decoder->data);
+  free(decoder);
+}
@@ -0,0 +1,200 @@
+#ifndef LIBEVENODD_H
+#define LIBEVENODD_H
+
+#include <stdbool.h>
+
+/*
+ * libevenodd：不依赖文件系统的 EVENODD 编解码库。
+ * 编码器按原文件的顺序接收调用者缓存区中的数据，把每一列的内容依次交给
+ * 调用者提供的 sink；解码器逐批接收各列的数据，把原文件交给 sink。
+ * 各列的内容（文件头、条带数据、CRC32C 文件尾）与 evenodd 命令行程序
+ * 写出的 disk_i/<file_name> 逐字节相同。
+ *
+ * 使用其他函数前需要调用一次 evenodd_init()。
+ *
+ * @example
+ * bool to_socket(void *arg, int column, const void *data, long long len) {
+ *   return send_column(((int *)arg)[column], data, len) == len;
+ * }
+ *
+ * struct File_info info = {size, 5, 1, true}; // p = 5，元素 8 字节，带 CRC
+ * struct Evenodd_sink sink = {to_socket, NULL, sockets};
+ * struct Evenodd_encoder *encoder = evenodd_encoder_new(&info, sink);
+ * while ((len = recv_object(buf, sizeof(buf))) > 0)
+ *   evenodd_encoder_write(encoder, buf, len);
+ * evenodd_encoder_finish(encoder);
+ * evenodd_encoder_free(encoder);
+ */
+
+typedef unsigned long long uint64;
+
+/*
+ * 加密数据文件开头的 8 字节文件头：
+ * 第 0 ... 7 位为 p，第 8 ... 47 位为原文件大小，
+ * 第 48 位表示数据之后是否有 CRC32C 文件尾，
+ * 第 52 ... 55 位为编码方式（CODE_EVENODD / CODE_RDP），
+ * 第 56 ... 63 位为 log2(元素字节数 / 8)。
+ * 旧格式的文件头为 file_size << 8 | p，对应元素字节数为 8。
+ * p 为数据列数：EVENODD 的 p 为质数；RDP 的 p + 1 为质数。
+ */
+struct File_info {
+  long long file_size; // 原文件大小
+  int p;               // 数据列数
+  int w;               // 每个元素包含的 uint64 个数
+  bool crc;            // 是否有 CRC32C 文件尾
+  int code;            // 编码方式
+};
+
+enum { CODE_EVENODD = 0, CODE_RDP = 1 };
+
+struct Decode_plan;
+
+uint64 make_header(const struct File_info *info);
+void parse_header(uint64 x, struct File_info *info);
+
+/**
+ * @brief CRC32C 文件尾中每块包含的条带数。
+ */
+long long crc_block_stripes(const struct File_info *info);
+
+/**
+ * @brief 原文件占用的条带数。
+ */
+long long get_stripe_num(const struct File_info *info);
+
+/**
+ * @brief 编码使用的质数：EVENODD 为 p，RDP 为 p + 1。
+ * 每个条带中每列有 get_prime(info) - 1 个元素。
+ */
+int get_prime(const struct File_info *info);
+
+/**
+ * @brief x 是否为质数。EVENODD 和 RDP 只在所用的数为质数时能恢复两列。
+ */
+bool is_prime(int x);
+
+/*
+ * 按编码方式和质数特化的编解码函数，用 get_codec(info) 取得，参数 p 为
+ * 数据列数。记 q = get_prime(info)，每个条带有 p + 2 列，每列 (q - 1) * w
+ * 个 uint64。
+ * encode：由 col[0 ... p - 1] 计算两个校验列 col[p]、col[p + 1]；
+ * encode_batch：data 中依次存放 k 个条带（每个条带的 p 个数据列连续存放），
+ *   把各条带的第 i 列依次写到 out[i]（0 <= i < p + 2）；
+ * decode：按解码计划 plan 恢复损坏的列（损坏的列需要预先清零）；
+ *   每列需要 q 个元素，最后一个为 0，work 至少为 2q + 1 个元素。
+ */
+struct Codec {
+  void (*encode)(uint64 *const *col, const int p, const int w);
+  void (*encode_batch)(const uint64 *data, uint64 *const *out,
+                       const long long k, const int p, const int w);
+  void (*decode)(uint64 *const *col, const struct Decode_plan *plan,
+                 uint64 *work, const int p, const int w);
+};
+
+struct Codec get_codec(const struct File_info *info);
+
+/**
+ * @brief 取得损坏列对应的解码计划。
+ * 计划按 (编码方式, p, 损坏列) 只生成一次，之后所有条带、所有文件共用，
+ * 解码时不再计算下标。可以在多个线程中同时调用，返回的计划不需要释放。
+ * @param idx 损坏列的编号（从小到大）
+ * @param number_erasures 损坏列数，为 1 或 2；为 1 时 idx[1] 可以是第 p + 1
+ * 列，表示不恢复对角线校验列
+ * @return 解码计划
+ */
+const struct Decode_plan *get_decode_plan(const struct File_info *info,
+                                          const int *idx,
+                                          const int number_erasures);
+
+/**
+ * @brief 为单个损坏的数据列 lost 制定混合修复计划：一部分行按行校验修复，
+ * 其余按对角线校验修复，使需要读入的元素尽量重叠。
+ * 记 rows = get_prime(info) - 1。
+ * @param by_row 结果，共 rows 项：第 r 行是否按行校验修复
+ * @param need 结果，共 (p + 2) * rows 项：need[i * rows + r] 表示每个条带
+ * 中需要读入第 i 列的第 r 个元素
+ * @return 每个条带需要读入的元素个数
+ */
+int plan_hybrid_repair(const struct File_info *info, const int lost,
+                       bool *by_row, bool *need);
+
+/**
+ * @brief 按 plan_hybrid_repair 的计划求出一个条带中第 lost 列的全部元素。
+ * col 中只有计划中需要读入的元素会被用到。
+ * @return NULL
+ */
+void decode_hybrid(const struct File_info *info, uint64 *const *col,
+                   const int lost, const bool *by_row);
+
+/**
+ * @brief 选择 XOR 内核和 CRC32C 的实现。
+ */
+void evenodd_init();
+
+void evenodd_xor_into(uint64 *dst, const uint64 *src, long long n);
+unsigned evenodd_crc32c(unsigned crc, const void *buf, long long len);
+
+/**
+ * @brief 接收编码 / 解码结果的回调。
+ * write 把第 column 列接下来的 len 字节交给调用者（解码器写出原文件时
+ * column 为 -1），返回 false 表示出错，之后不再调用。
+ * reserve 可以为 NULL：不为 NULL 时编码器先向它要第 column 列接下来 len
+ * 字节的缓存区，直接编码到其中，再以该地址调用 write；返回 NULL 时改用
+ * 编码器自己的缓存区。
+ */
+struct Evenodd_sink {
+  bool (*write)(void *arg, int column, const void *data, long long len);
+  void *(*reserve)(void *arg, int column, long long len);
+  void *arg;
+};
+
+struct Evenodd_encoder;
+struct Evenodd_decoder;
+
+/**
+ * @brief 创建编码器。info->file_size 为之后写入的总字节数。
+ * 编码方式须为 CODE_EVENODD 或 CODE_RDP，get_prime(info) 须为质数，
+ * EVENODD 要求 3 <= p <= 255，RDP 要求 4 <= p <= 255，w 为 2 的幂。
+ * @return 编码器，参数不合法时返回 NULL
+ */
+struct Evenodd_encoder *evenodd_encoder_new(const struct File_info *info,
+                                            struct Evenodd_sink sink);
+
+/**
+ * @brief 按原文件的顺序写入 len 字节。
+ * 凑满的条带立即编码，各列的数据交给 sink；不足一个条带的部分先暂存。
+ * @return 是否成功（写入超过 file_size 或 sink 出错时失败）
+ */
+bool evenodd_encoder_write(struct Evenodd_encoder *encoder, const void *data,
+                           long long len);
+
+/**
+ * @brief 补零编码最后一个条带，并写出各列的 CRC32C 文件尾。
+ * @return 是否成功（写入的字节数不等于 file_size 或 sink 出错时失败）
+ */
+bool evenodd_encoder_finish(struct Evenodd_encoder *encoder);
+
+void evenodd_encoder_free(struct Evenodd_encoder *encoder);
+
+/**
+ * @brief 创建解码器。info 的要求同 evenodd_encoder_new。
+ * @param lost lost[i] 表示第 i 列缺失（共 p + 2 个），为 NULL 时表示全部完好
+ * @return 解码器，参数不合法或缺失超过 2 列时返回 NULL
+ */
+struct Evenodd_decoder *evenodd_decoder_new(const struct File_info *info,
+                                            const bool *lost,
+                                            struct Evenodd_sink sink);
+
+/**
+ * @brief 按条带顺序写入接下来 stripes 个条带的各列数据，解出原文件。
+ * columns[i] 指向第 i 列这些条带的数据（不含文件头），共
+ * stripes * (get_prime(info) - 1) * w 个 uint64；缺失的列可以为 NULL。
+ * 原文件的数据交给 sink，最后一个条带只写出 file_size 以内的部分。
+ * @return 是否成功
+ */
+bool evenodd_decoder_write(struct Evenodd_decoder *decoder,
+                           const uint64 *const *columns, long long stripes);
+
+void evenodd_decoder_free(struct Evenodd_decoder *decoder);
+
+#endif
@@ -5,6 +5,11 @@ from pathlib import Path
 import time
 import random
 import hashlib
+import subprocess
+import socket
+import struct
+import signal
+import resource
 
 test_id = 0
 data_size = 0
@@ -51,15 +56,25 @@ def add_time(command):
     total_time += used
 
 
-def write(file_name, p): return add_time(f'./evenodd write {file_name} {p}')
+def write(file_name, p, opts=''): return add_time(
+    f'./evenodd write {file_name} {p}{opts}')
 
 
-def read(file_name, save_as): return add_time(
-    f'./evenodd read {file_name} {save_as}')
+def read(file_name, save_as, opts=''): return add_time(
+    f'./evenodd read {file_name} {save_as}{opts}')
 
 
-def repair(idx): return add_time(
-    f'./evenodd repair {len(idx)} {" ".join(map(str, idx))}')
+def repair(idx, opts=''): return add_time(
+    f'./evenodd repair {len(idx)} {" ".join(map(str, idx))}{opts}')
+
+
+def update(file_name, offset, data_file): return add_time(
+    f'./evenodd update {file_name} {offset} {data_file}')
+
+
+def scrub(opts=''):
+    return subprocess.run(f'./evenodd scrub{opts}'.split(), capture_output=True,
+                          text=True)
 
 
 def gen(file_bytes, file_name, seed):
@@ -165,6 +180,678 @@ def repair_test(size, n, p, idx):
     reset()
 
 
+def drop_manifest_record(file_name):
+    for manifest in Path('.').glob('disk_*/.manifest'):
+        lines = manifest.read_text().splitlines(keepends=True)
+        manifest.write_text(''.join(
+            x for x in lines if x.rstrip('\n').split(' ', 5)[-1] != file_name))
+
+
+def manifest_hint_test(size, p, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+
+    print(
+        f'# 测试 {test_id}：size = {size}, p = {p}, idx = {idx}, seed = {cur_seed}（test2 不在清单中）')
+
+    for i in [1, 2]:
+        cur_seed += 1
+        testfile = f'testfile/test{i}'
+        gen(size, testfile, cur_seed)
+        write(testfile, p)
+    drop_manifest_record('testfile/test2')
+
+    hashes = []
+    for x in idx:
+        hashes.append(sha256(f'disk_{x}'))
+        system(f'rm -r disk_{x}')
+
+    repair(idx)
+
+    for i in range(len(idx)):
+        if sha256(f'disk_{idx[i]}') != hashes[i]:
+            print(f'# 测试不通过，disk_{idx[i]} 未正确修复')
+            exit(-1)
+
+    for x in idx:
+        system(f'rm -r disk_{x}')
+    read('testfile/test2', 'savefile/save2')
+    return_code = system('diff -q testfile/test2 savefile/save2')
+    if return_code != 0:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def pack_overwrite_test(p):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+
+    print(f'# 测试 {test_id}：p = {p}, seed = {cur_seed}（普通 / 打包交替写入同名文件）')
+    for pack in [False, True, False, True]:
+        cur_seed += 1
+        gen(3000 + cur_seed, testfile, cur_seed)
+        add_time(
+            f'./evenodd write {testfile} {p}{" --pack" if pack else ""}')
+        read(testfile, savefile)
+        return_code = system(f'diff -q {testfile} {savefile}')
+        if return_code != 0:
+            print(f'# 测试不通过，diff 返回值为 {return_code}')
+            exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def rdp_test(n, q, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+
+    # RDP 的数据列为 0 ... q - 2，行校验列为 q - 1，对角线校验列为 q
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, q = {q}, idx = {idx}, seed = {cur_seed}（RDP）')
+    gen(n, testfile, cur_seed)
+    write(testfile, q, ' --code rdp')
+
+    hashes = []
+    for x in idx:
+        hashes.append(sha256(f'disk_{x}'))
+        system(f'rm -r disk_{x}')
+
+    read(testfile, savefile)
+    return_code = system(f'diff -q {testfile} {savefile}')
+    if return_code != 0:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+
+    repair(idx)
+
+    for i in range(len(idx)):
+        if sha256(f'disk_{idx[i]}') != hashes[i]:
+            print(f'# 测试不通过，disk_{idx[i]} 未正确修复')
+            exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def update_patches(n, q, rdp, esize):
+    column_bytes = (q - 1) * esize
+    stripe_bytes = (q - 1 if rdp else q) * column_bytes
+    if rdp:
+        # 第 1 列第 q - 2 行在不存储的第 q - 1 条对角线上；第 2 列第 0 行的
+        # 行校验元素也落在第 q - 1 条对角线上
+        special = [(1, q - 2), (2, 0)]
+    else:
+        # 第 2 列第 p - 3 行在调整因子 S 所在的对角线上
+        special = [(2, q - 3)]
+    patches = [(stripe_bytes + i * column_bytes + j * esize, esize)
+               for i, j in special]
+    patches.append((column_bytes - 3, 2 * esize + 6))  # 跨列、不对齐
+    patches.append((stripe_bytes - 5, 2 * stripe_bytes + 11))  # 跨条带
+    patches.append((n - 7, 7))  # 文件末尾
+    return patches
+
+
+def update_test(n, q, opts, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+    patchfile = 'testfile/patch'
+    rdp = '--code rdp' in opts
+    esize = int(opts.split('--element-size ')[1].split()[0]) \
+        if '--element-size' in opts else 8
+    cols = q + 1 if rdp else q + 2
+
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {q}, opts = "{opts.strip()}", idx = {idx}, seed = {cur_seed}')
+    gen(n, testfile, cur_seed)
+    write(testfile, q, opts)
+    expect = bytearray(Path(testfile).read_bytes())
+
+    for x in idx:
+        system(f'rm -r disk_{x}')
+
+    for offset, length in update_patches(n, q, rdp, esize):
+        cur_seed += 1
+        gen(length, patchfile, cur_seed)
+        expect[offset:offset + length] = Path(patchfile).read_bytes()
+        update(testfile, offset, patchfile)
+
+    # 越界的修改不改变文件
+    gen(10, patchfile, cur_seed)
+    for offset in [n - 5, -1]:
+        output = subprocess.run(
+            ['./evenodd', 'update', testfile, str(offset), patchfile],
+            capture_output=True, text=True).stdout
+        if output != 'Update out of range!\n':
+            print(f'# 测试不通过，越界的 update 输出为 {output.strip()}')
+            exit(-1)
+
+    Path('savefile').mkdir(exist_ok=True)
+    Path('savefile/expect').write_bytes(expect)
+    # --crc 时去掉两列后读出，其余各列的 CRC32C 文件尾必须已更新
+    erasures = [[]] + ([[0, 1], [cols - 2, cols - 1]] if '--crc' in opts else [])
+    for pair in erasures:
+        for x in pair:
+            system(f'rm -r disk_{x}')
+        read(testfile, savefile)
+        return_code = system(f'diff -q savefile/expect {savefile}')
+        if return_code != 0:
+            print(f'# 测试不通过，diff 返回值为 {return_code}')
+            exit(-1)
+        repair(pair)
+
+    output = scrub().stdout
+    if ' 0 inconsistent stripes' not in output:
+        print(f'# 测试不通过，scrub 输出为 {output.strip()}')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def equivalence_test(n, p, layout, mode, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+
+    # layout 决定列文件的格式；加上 mode 后 write / read / repair 的结果应当不变
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {p}, layout = "{layout.strip()}", mode = "{mode.strip()}", idx = {idx}, seed = {cur_seed}')
+    gen(n, testfile, cur_seed)
+    write(testfile, p, layout)
+    hashes = [sha256(x) for x in sorted(Path('.').glob(f'disk_*/{testfile}'))]
+    system('rm -r disk_*')
+
+    write(testfile, p, layout + mode)
+    if [sha256(x) for x in sorted(Path('.').glob(f'disk_*/{testfile}'))] != hashes:
+        print(f'# 测试不通过，加上 "{mode.strip()}" 后写出的列不同')
+        exit(-1)
+    for x in idx:
+        system(f'rm -r disk_{x}')
+    read(testfile, savefile, mode)
+    return_code = system(f'diff -q {testfile} {savefile}')
+    if return_code != 0:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+    repair(idx, mode)
+    if [sha256(x) for x in sorted(Path('.').glob(f'disk_*/{testfile}'))] != hashes:
+        print(f'# 测试不通过，加上 "{mode.strip()}" 后修复的列不同')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def hybrid_repair_test(n, p, layout, mode, lost):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {p}, layout = "{layout.strip()}", mode = "{mode.strip()}", lost = {lost}, seed = {cur_seed}（混合修复）')
+    gen(n, testfile, cur_seed)
+    write(testfile, p, layout)
+    columns = sorted(Path('.').glob(f'disk_*/{testfile}'))
+    hashes = [sha256(x) for x in columns]
+    system(f'rm -r disk_{lost}')
+    healthy = sum(x.stat().st_size for x in columns if x.exists())
+
+    result = subprocess.run(f'./evenodd repair 1 {lost}{mode} --stats'.split(),
+                            capture_output=True, text=True)
+    if [sha256(x) for x in columns] != hashes:
+        print(f'# 测试不通过，disk_{lost} 未正确修复')
+        exit(-1)
+    # 混合修复只读入约 3/4 的元素，按行 / 对角线修复时要读入其余各列的全部数据；
+    # --direct 时按对齐的块读入，不比较读入的字节数
+    used = sum(int(x.split()[3]) for x in result.stdout.splitlines()
+               if x.startswith('column '))
+    if '--direct' not in mode and used > healthy * 0.85:
+        print(f'# 测试不通过，修复读入 {used} 字节，其余各列共 {healthy} 字节')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def flip_byte(path, pos):
+    with open(path, 'r+b') as f:
+        f.seek(pos)
+        byte = f.read(1)
+        f.seek(pos)
+        f.write(bytes([byte[0] ^ 0x5a]))
+
+
+def crc_test(n, p, flips, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {p}, flips = {flips}, idx = {idx}, seed = {cur_seed}（--crc）')
+    gen(n, testfile, cur_seed)
+    write(testfile, p, ' --crc')
+
+    for x in idx:
+        system(f'rm -r disk_{x}')
+    # 跳过 8 字节的文件头，在数据区中改一个字节
+    for x in flips:
+        column = Path(f'disk_{x}/{testfile}')
+        flip_byte(column, 8 + random.randrange(column.stat().st_size - 8))
+
+    read(testfile, savefile)
+    return_code = system(f'diff -q {testfile} {savefile}')
+    if return_code == 0:
+        print('# 测试通过')
+    else:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+
+
+def scrub_test(n, p, opts, column):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {p}, opts = "{opts.strip()}", column = {column}, seed = {cur_seed}（scrub）')
+    gen(n, testfile, cur_seed)
+    write(testfile, p, opts)
+    path = Path(f'disk_{column}/{testfile}')
+    expected = sha256(path)
+    # 在数据区（文件头之后、CRC32C 文件尾之前）改一个字节
+    flip_byte(path, 8 + random.randrange((n + p - 1) // p))
+
+    result = scrub()
+    if result.returncode != 1 or f'Damaged: {testfile}\n' not in result.stdout \
+            or f' column {column}\n' not in result.stdout:
+        print(f'# 测试不通过，scrub 返回值为 {result.returncode}，输出为 {result.stdout.strip()}')
+        exit(-1)
+    result = scrub(' --repair')
+    if result.returncode != 0 or sha256(path) != expected:
+        print(f'# 测试不通过，scrub --repair 返回值为 {result.returncode}，'
+              f'disk_{column} 中的列{"相同" if sha256(path) == expected else "不同"}')
+        exit(-1)
+    result = scrub()
+    if result.returncode != 0 or 'Damaged' in result.stdout:
+        print(f'# 测试不通过，改正后 scrub 输出为 {result.stdout.strip()}')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def range_test(n, p, opts, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {p}, opts = "{opts.strip()}", idx = {idx}, seed = {cur_seed}（--offset / --length）')
+    gen(n, testfile, cur_seed)
+    write(testfile, p, opts)
+    data = Path(testfile).read_bytes()
+
+    for x in idx:
+        system(f'rm -r disk_{x}')
+
+    ranges = [(0, 1), (0, n), (n // 3, 1), (n // 3 - 5, 4099),
+              (n // 2, n // 4), (n - 3, None), (n // 7, None)]
+    for offset, length in ranges:
+        expect = data[offset:] if length is None else data[offset:offset + length]
+        opt = '' if length is None else f' --length {length}'
+        add_time(
+            f'./evenodd read {testfile} {savefile} --offset {offset}{opt}')
+        if Path(savefile).read_bytes() != expect:
+            print(f'# 测试不通过，offset = {offset}, length = {length} 读出的数据不正确')
+            exit(-1)
+
+    # 只在内存中解码，不修复磁盘上的文件
+    for x in idx:
+        if Path(f'disk_{x}/{testfile}').exists():
+            print(f'# 测试不通过，disk_{x} 被修改')
+            exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def write_back_test(n, p, opts, idx):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+
+    print(
+        f'# 测试 {test_id}：n = {fmt_size(n)}, p = {p}, opts = "{opts.strip()}", idx = {idx}, seed = {cur_seed}（--write-back）')
+    gen(n, testfile, cur_seed)
+    write(testfile, p, opts)
+
+    hashes = []
+    for x in idx:
+        hashes.append(sha256(f'disk_{x}/{testfile}'))
+        system(f'rm disk_{x}/{testfile}')
+
+    add_time(f'./evenodd read {testfile} {savefile} --write-back')
+    return_code = system(f'diff -q {testfile} {savefile}')
+    if return_code != 0:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+    for i in range(len(idx)):
+        if sha256(f'disk_{idx[i]}/{testfile}') != hashes[i]:
+            print(f'# 测试不通过，disk_{idx[i]} 未正确修复')
+            exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def serve_call(conn, args):
+    body = b''.join(x.encode() + b'\0' for x in args)
+    conn.sendall(struct.pack('=I', len(body)) + body)
+    reply = b''
+    while len(reply) < 4 or len(reply) < 4 + struct.unpack('=I', reply[:4])[0]:
+        chunk = conn.recv(65536)
+        if not chunk:
+            return None, ''
+        reply += chunk
+    head, _, text = reply[4:].decode().partition('\n')
+    return int(head.split()[0]), text
+
+
+def serve_test(p):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    savefile = 'savefile/save1'
+    sock_path = 'testfile/serve.sock'
+
+    print(f'# 测试 {test_id}：p = {p}, seed = {cur_seed}（同一连接上先失败、再成功的请求）')
+    gen(10**5, testfile, cur_seed)
+    Path('savefile').mkdir(exist_ok=True)
+    server = subprocess.Popen(
+        ['./evenodd', 'serve', '--socket', sock_path, '--threads', '2'],
+        stdout=subprocess.DEVNULL)
+    for _ in range(100):
+        if Path(sock_path).exists():
+            break
+        time.sleep(0.05)
+    conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    conn.connect(sock_path)
+
+    requests = [(['write', 'testfile/nosuch', str(p)], 1),
+                (['write', testfile, str(p), '--pack'], 0),
+                (['read', 'testfile/nosuch', savefile], 1),
+                (['write', testfile, str(p)], 0),
+                (['read', testfile, savefile], 0)]
+    for args, expect in requests:
+        status, text = serve_call(conn, args)
+        if status != expect:
+            print(f'# 测试不通过，{" ".join(args)} 的 status 为 {status}，输出为 {text.strip()}')
+            server.kill()
+            exit(-1)
+    conn.close()
+    alive = server.poll() is None
+    server.kill()
+    server.wait()
+    if not alive:
+        print('# 测试不通过，服务进程已退出')
+        exit(-1)
+    return_code = system(f'diff -q {testfile} {savefile}')
+    if return_code != 0:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def bulk_test(p, threads):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+
+    print(f'# 测试 {test_id}：p = {p}, threads = {threads}, seed = {cur_seed}（批量读写，其中一项不存在）')
+    files = []
+    for i in range(6):
+        cur_seed += 1
+        files.append(f'testfile/bulk/f{i}')
+        gen(1000 * cur_seed, files[-1], cur_seed)
+    Path('savefile').mkdir(exist_ok=True)
+    Path('testfile/bulk/dangling').symlink_to('nosuch')  # -r 时跳过
+    Path('testfile/wlist').write_text(
+        '\n'.join(files[:3] + ['testfile/nosuch'] + files[3:]) + '\n')
+    Path('testfile/rlist').write_text(''.join(
+        f'{x} savefile/s{i}\n' for i, x in enumerate(files[:2] + ['testfile/nosuch'] + files[2:])))
+
+    def run(command):
+        return subprocess.run(f'{command} --threads {threads}'.split(),
+                              stdout=subprocess.DEVNULL).returncode
+
+    def check(expect, got, command):
+        if got != expect:
+            print(f'# 测试不通过，{command} 的返回值为 {got}')
+            exit(-1)
+
+    check(0, run(f'./evenodd write -r testfile/bulk {p}'), 'write -r')
+    system('rm -r disk_*')
+    check(1, run(f'./evenodd write --from-list testfile/wlist {p}'),
+          'write --from-list')
+    check(1, run('./evenodd read --from-list testfile/rlist'),
+          'read --from-list')
+    for i, x in enumerate(files[:2] + [None] + files[2:]):
+        if x is not None and system(f'diff -q {x} savefile/s{i}') != 0:
+            print(f'# 测试不通过，{x} 读出的数据不正确')
+            exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def invalid_prime_test(p, opts, message):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+
+    print(f'# 测试 {test_id}：p = {p}, opts = "{opts.strip()}"（应当拒绝）')
+    gen(1000, testfile, cur_seed)
+    result = subprocess.run(f'./evenodd write {testfile} {p}{opts}'.split(),
+                            capture_output=True, text=True)
+    if result.returncode != 1 or result.stdout != message + '\n':
+        print(f'# 测试不通过，返回值为 {result.returncode}，输出为 {result.stdout.strip()}')
+        exit(-1)
+    if list(Path('.').glob(f'disk_*/{testfile}')):
+        print('# 测试不通过，写出了列文件')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def pack_crc_test(p, sizes):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+
+    print(f'# 测试 {test_id}：p = {p}, sizes = {sizes}, seed = {cur_seed}（--pack --crc）')
+    files = []
+    for size in sizes:
+        cur_seed += 1
+        files.append(f'testfile/f{len(files)}')
+        gen(size, files[-1], cur_seed)
+        add_time(f'./evenodd write {files[-1]} {p} --pack --crc')
+
+    # 容器的各列应当与整体加密首尾相接的各文件相同（包括 CRC32C 文件尾）
+    system(f'cat {" ".join(files)} > testfile/concat')
+    write('testfile/concat', p, ' --crc')
+    for i in range(p + 2):
+        if sha256(f'disk_{i}/.pack/p{p}_e8_crc_0') != sha256(f'disk_{i}/testfile/concat'):
+            print(f'# 测试不通过，disk_{i} 中容器的内容不正确')
+            exit(-1)
+
+    # 改动一列、去掉另一列后仍能读出
+    column = Path(f'disk_1/.pack/p{p}_e8_crc_0')
+    flip_byte(column, 8 + random.randrange(column.stat().st_size - 8))
+    system(f'rm -r disk_{p}')
+    for i, x in enumerate(files):
+        read(x, f'savefile/s{i}')
+        return_code = system(f'diff -q {x} savefile/s{i}')
+        if return_code != 0:
+            print(f'# 测试不通过，diff 返回值为 {return_code}')
+            exit(-1)
+
+    # 不存在的文件不写入索引
+    code = subprocess.run(f'./evenodd write testfile/nosuch {p} --pack'.split(),
+                          stdout=subprocess.DEVNULL).returncode
+    code_read = subprocess.run('./evenodd read testfile/nosuch savefile/nosuch'.split(),
+                               stdout=subprocess.DEVNULL).returncode
+    if code != 1 or code_read != 1:
+        print(f'# 测试不通过，打包不存在的文件返回 {code}，读出返回 {code_read}')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
+def run_limited(command, limit):
+    # 文件大小上限为 limit 字节：超出的写入以 EFBIG 失败，模拟磁盘已满
+    def set_limit():
+        signal.signal(signal.SIGXFSZ, signal.SIG_IGN)
+        resource.setrlimit(resource.RLIMIT_FSIZE, (limit, limit))
+    return subprocess.run(command.split(), capture_output=True, text=True,
+                          preexec_fn=set_limit)
+
+
+def write_failure_test(p, opts):
+    global cur_seed, test_id
+
+    reset()
+
+    test_id += 1
+    cur_seed += 1
+
+    testfile = 'testfile/test1'
+    limit = 1 << 16
+
+    print(f'# 测试 {test_id}：p = {p}, opts = "{opts.strip()}"（写出失败）')
+    gen(10**6, testfile, cur_seed)
+
+    def expect_failure(command):
+        result = run_limited(command, limit)
+        if result.returncode != 1 or 'Write failed!' not in result.stdout:
+            print(f'# 测试不通过，`{command}` 返回值为 {result.returncode}，'
+                  f'输出为 {result.stdout.strip()}')
+            exit(-1)
+
+    expect_failure(f'./evenodd write {testfile} {p}{opts}')
+    system('rm -r disk_*')
+    write(testfile, p, opts)
+    expected = sha256(f'disk_1/{testfile}')
+    system('rm -r disk_1')
+    expect_failure(f'./evenodd repair 1 1{opts}')
+    add_time(f'./evenodd repair 1 1{opts}')
+    if sha256(f'disk_1/{testfile}') != expected:
+        print('# 测试不通过，之后的修复结果不正确')
+        exit(-1)
+    expect_failure(f'./evenodd read {testfile} savefile/s1{opts}')
+
+    # 写出失败的 update 之后重新 update，结果仍然正确
+    cur_seed += 1
+    gen(300000, 'testfile/patch', cur_seed)
+    expect_failure(f'./evenodd update {testfile} 600000 testfile/patch{opts}')
+    update(testfile, 600000, 'testfile/patch')
+    with open(testfile, 'r+b') as f, open('testfile/patch', 'rb') as g:
+        f.seek(600000)
+        f.write(g.read())
+    read(testfile, 'savefile/s1')
+    return_code = system(f'diff -q {testfile} savefile/s1')
+    if return_code != 0:
+        print(f'# 测试不通过，diff 返回值为 {return_code}')
+        exit(-1)
+
+    # 追加失败时容器不变，也不记入索引
+    reset()
+    cur_seed += 1
+    gen(1000, 'testfile/small', cur_seed)
+    cur_seed += 1
+    gen(500000, 'testfile/big', cur_seed)
+    write('testfile/small', p, ' --pack' + opts)
+    before = [sha256(f'disk_{i}/.pack') for i in range(p + 2)]
+    expect_failure(f'./evenodd write testfile/big {p} --pack{opts}')
+    if [sha256(f'disk_{i}/.pack') for i in range(p + 2)] != before:
+        print('# 测试不通过，追加失败后容器被改动')
+        exit(-1)
+    code = subprocess.run('./evenodd read testfile/big savefile/big'.split(),
+                          stdout=subprocess.DEVNULL).returncode
+    read('testfile/small', 'savefile/small')
+    return_code = system('diff -q testfile/small savefile/small')
+    if code != 1 or return_code != 0:
+        print(f'# 测试不通过，读出失败的文件返回 {code}，diff 返回值为 {return_code}')
+        exit(-1)
+    print(f'# 测试通过')
+    reset()
+
+
 def subtask_plain_rw():
     global test_id
 
@@ -233,12 +920,261 @@ def subtask_repair():
     print()
 
 
+def subtask_rdp():
+    global test_id
+
+    test_id = 0
+    print('# 测试：RDP')
+    for n in [1000, 10**6]:
+        for q in [5, 7, 13]:
+            rdp_test(n, q, [])
+            rdp_test(n, q, [0])
+            rdp_test(n, q, [q - 2])
+            rdp_test(n, q, [0, 1])
+            rdp_test(n, q, [1, q - 2])
+            rdp_test(n, q, [q - 1])
+            rdp_test(n, q, [q])
+            rdp_test(n, q, [q - 1, q])
+            rdp_test(n, q, [1, q - 1])
+            rdp_test(n, q, [q - 2, q])
+    print()
+
+
+def subtask_update():
+    global test_id
+
+    test_id = 0
+    print('# 测试：update')
+    for q in [5, 7, 13]:
+        update_test(10**5, q, '', [])
+        update_test(10**5, q, ' --element-size 64', [])
+        update_test(10**5, q, ' --crc', [])
+        update_test(10**5, q, ' --code rdp', [])
+        update_test(10**5, q, ' --code rdp --crc --element-size 32', [])
+        update_test(10**5, q, '', [1])
+        update_test(10**5, q, ' --crc', [0, q + 1])
+        update_test(10**5, q, ' --code rdp', [q - 1])
+    print()
+
+
+def subtask_crc():
+    global test_id
+
+    test_id = 0
+    print('# 测试：--crc 时列文件被改动')
+    for n in [1000, 10**6]:
+        for p in [3, 7, 13]:
+            crc_test(n, p, [0], [])
+            crc_test(n, p, [p - 1], [])
+            crc_test(n, p, [p], [])
+            crc_test(n, p, [p + 1], [])
+            crc_test(n, p, [1, p], [])
+            crc_test(n, p, [2], [0])
+            crc_test(n, p, [0], [p + 1])
+    print()
+
+
+def subtask_scrub():
+    global test_id
+
+    test_id = 0
+    print('# 测试：scrub 发现并改正损坏的列')
+    for n in [10**4, 10**6]:
+        for p in [5, 7, 13]:
+            scrub_test(n, p, '', 0)
+            scrub_test(n, p, '', p - 1)
+            scrub_test(n, p, '', p)
+            scrub_test(n, p, '', p + 1)
+            scrub_test(n, p, ' --crc', 1)
+            scrub_test(n, p, ' --crc', p + 1)
+            scrub_test(n, p, ' --element-size 64', 2)
+            scrub_test(n, p, ' --code rdp', 0)
+            scrub_test(n, p, ' --code rdp', p)
+    print()
+
+
+def subtask_range():
+    global test_id
+
+    test_id = 0
+    print('# 测试：读出一段 / --write-back')
+    for n in [10**4, 10**6]:
+        for p in [5, 7, 13]:
+            range_test(n, p, '', [])
+            range_test(n, p, ' --element-size 64', [1])
+            range_test(n, p, '', [0, p - 1])
+            range_test(n, p, ' --crc', [2, p])
+            range_test(n, p, ' --code rdp', [0, 1])
+            write_back_test(n, p, '', [1])
+            write_back_test(n, p, ' --crc', [0, p + 1])
+            write_back_test(n, p, ' --code rdp', [p - 2, p - 1])
+    print()
+
+
+def subtask_threads():
+    global test_id
+
+    test_id = 0
+    print('# 测试：--threads 与单线程结果相同')
+    # 不小于 16 MB 的文件按条带区间并行修复
+    for n in [1000, 10**6, 3 * 10**7]:
+        for p in [5, 7, 13]:
+            for threads in [2, 4]:
+                mode = f' --threads {threads}'
+                equivalence_test(n, p, '', mode, [1])
+                equivalence_test(n, p, ' --crc', mode, [0, p])
+                equivalence_test(n, p, ' --element-size 64', mode, [p + 1])
+                equivalence_test(n, p, ' --code rdp', mode, [0, p - 1])
+    print()
+
+
+def subtask_io_uring():
+    global test_id
+
+    test_id = 0
+    print('# 测试：--io uring 与 stdio 结果相同')
+    for n in [1000, 10**6, 2 * 10**7]:
+        for p in [5, 13]:
+            for mode in [' --io uring', ' --io uring --threads 4']:
+                equivalence_test(n, p, '', mode, [1])
+                equivalence_test(n, p, ' --crc', mode, [0, p + 1])
+                equivalence_test(n, p, ' --element-size 64', mode, [p])
+                equivalence_test(n, p, ' --code rdp --crc', mode, [1, 2])
+    print()
+
+
+def subtask_direct():
+    global test_id
+
+    test_id = 0
+    print('# 测试：--direct 与页缓存读写结果相同')
+    # 文件头使列数据不按块对齐，各种大小都要覆盖首尾不完整的块
+    for n in [1000, 10**6 + 7, 2 * 10**7 + 4099]:
+        for p in [5, 13]:
+            for mode in [' --direct', ' --direct --threads 4',
+                         ' --direct --io uring']:
+                equivalence_test(n, p, '', mode, [1])
+                equivalence_test(n, p, ' --crc', mode, [0, p + 1])
+                equivalence_test(n, p, ' --element-size 4096', mode, [p, 2])
+                equivalence_test(n, p, ' --code rdp', mode, [p - 1])
+    print()
+
+
+def subtask_hybrid():
+    global test_id
+
+    test_id = 0
+    print('# 测试：元素不小于 4096 字节时的混合修复')
+    for n in [10**5, 10**7 + 3]:
+        for p in [5, 7, 13]:
+            for mode in ['', ' --threads 4', ' --direct']:
+                hybrid_repair_test(n, p, ' --element-size 4096', mode, 0)
+                hybrid_repair_test(n, p, ' --element-size 4096 --crc', mode,
+                                   p - 1)
+                hybrid_repair_test(n, p, ' --element-size 8192', mode, p // 2)
+                hybrid_repair_test(n, p, ' --element-size 4096 --code rdp',
+                                   mode, p - 2)
+            equivalence_test(n, p, ' --element-size 4096', ' --threads 4', [1])
+    print()
+
+
+def subtask_serve():
+    global test_id
+
+    test_id = 0
+    print('# 测试：serve')
+    for p in [5, 13]:
+        serve_test(p)
+    print()
+
+
+def subtask_bulk():
+    global test_id
+
+    test_id = 0
+    print('# 测试：批量读写')
+    for p in [3, 7]:
+        for threads in [1, 4]:
+            bulk_test(p, threads)
+    print()
+
+
+def subtask_invalid():
+    global test_id
+
+    test_id = 0
+    print('# 测试：不合法的 p')
+    not_prime = 'p should be a prime number!'
+    invalid_prime_test(9, '', not_prime)
+    invalid_prime_test(1, '', not_prime)
+    invalid_prime_test(-7, '', not_prime)
+    invalid_prime_test(8, ' --code rdp', not_prime)
+    invalid_prime_test(6, ' --code rdp', not_prime)
+    invalid_prime_test(15, ' --pack', not_prime)
+    invalid_prime_test(2, '', 'EVENODD needs p >= 3!')
+    invalid_prime_test(3, ' --code rdp', 'RDP needs p >= 5!')
+    invalid_prime_test(101, '', 'Too many data columns (at most 100)!')
+    print()
+
+
+def subtask_write_failure():
+    global test_id
+
+    test_id = 0
+    print('# 测试：写出失败（磁盘已满）')
+    for p in [5, 7]:
+        for opts in ['', ' --crc', ' --threads 4', ' --io uring', ' --direct',
+                     ' --element-size 4096']:
+            write_failure_test(p, opts)
+    print()
+
+
+def subtask_manifest():
+    global test_id
+
+    test_id = 0
+    print('# 测试：清单中缺少的文件')
+    for size in [10**3, 10**6]:
+        manifest_hint_test(size, 5, [1])
+        manifest_hint_test(size, 7, [0, 2])
+        manifest_hint_test(size, 11, [3, 12])
+    print()
+
+
+def subtask_pack():
+    global test_id
+
+    test_id = 0
+    print('# 测试：打包')
+    for p in [3, 5, 13]:
+        pack_overwrite_test(p)
+    for p in [5, 11]:
+        pack_crc_test(p, [1])
+        pack_crc_test(p, [1000, 5, 300000, 77777, 1 << 20, 12345, 400000])
+    print()
+
+
 if __name__ == '__main__':
     random.seed(0)
 
     subtask_plain_rw()
     subtask_broken_rw()
     subtask_repair()
+    subtask_rdp()
+    subtask_update()
+    subtask_crc()
+    subtask_scrub()
+    subtask_range()
+    subtask_threads()
+    subtask_io_uring()
+    subtask_direct()
+    subtask_hybrid()
+    subtask_manifest()
+    subtask_pack()
+    subtask_serve()
+    subtask_bulk()
+    subtask_invalid()
+    subtask_write_failure()
 
 print(f'总用时：{total_time:.3f}s')
 print(f'瞬时最大占用磁盘空间（预计）：{(max_size / 1048576):.3f}MB')